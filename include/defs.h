@@ -10,6 +10,10 @@
 
 #define SYSCALL_DEBUG
 
+// fill freed and newly allocated pages with junk to catch
+// use-after-free and uninitialized reads. costs two page writes per page.
+//#define PMEM_DEBUG
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -44,11 +48,16 @@ void proc_mapstacks(pagetbl_t);
 void init_zero(void);
 void proc_scheduler(void) __attribute__((noreturn));
 void proc_sched(void);
+void sched_stat(void);
+int sched_preempt(void);
+int proc_nice(int);
 int grow_proc(int);
 void kexit(int);
 int kfork(void);
+int kthread_create(void (*)(void));
 void sleep(void*, spinlock_t*);
 void wakeup(void*);
+void wakeup_one(void*);
 void yield(void);
 int killed(proc_t*);
 int kwait(uint64);
@@ -70,11 +79,33 @@ char *safestrcpy(char *, const char *, int);
 int strlen(const char *);
 int strncmp(const char *, const char *, uint);
 char *strncpy(char *, const char *, int);
+extern int str_rvv;
+int ctz64(uint64);
+
+// str_rvv.S
+void memset_rvv(void *, int, uint);
+void memcpy_rvv(void *, const void *, uint);
+int memcmp_rvv(const void *, const void *, uint);
+int strlen_rvv(const char *);
 
 // pmem.c
+// flags or-ed into the pmem_alloc type (0 for kernel, 1 for user)
+#define PMEM_ZERO   0x10  // return a zeroed page
+#define PMEM_NOFILL 0x20  // caller overwrites the whole page, never junk-fill it
+// largest block handed out by the buddy allocator is 2^PMEM_MAX_ORDER pages
+#define PMEM_MAX_ORDER 10
 void pmem_init(void);
 void *pmem_alloc(int);
 void pmem_free(void *);
+void *pmem_alloc_order(int, int);
+void pmem_free_order(void *, int);
+void pmem_ref(void *);
+int pmem_refcnt(void *);
+int pmem_zero_idle(void);
+uint64 pmem_nfree(int);
+void pmem_drain(int);
+void pmem_nblocks(int, uint *);
+void pmem_stat(void);
 
 // vmem.c
 pagetbl_t kvmmake(void);
@@ -88,6 +119,8 @@ void kvminithart(void);
 pte_t *vm_getpte(pagetbl_t, uint64, int);
 uint64 vm_getpa(pagetbl_t, uint64);
 
+typedef int (*vm_walk_fn)(pte_t *, uint64, void *);
+int vm_walk(pagetbl_t, uint64, uint64, vm_walk_fn, void *);
 int vm_mappages(pagetbl_t, uint64, uint64, uint64, int);
 void vm_unmappages(pagetbl_t, uint64, uint64, int);
 
@@ -96,6 +129,8 @@ void vm_upage_free(pagetbl_t pagetable, uint64 sz);
 uint64 vm_u_alloc(pagetbl_t, uint64, uint64, int);
 uint64 vm_u_dealloc(pagetbl_t, uint64, uint64);
 int vm_u_copy(pagetbl_t, pagetbl_t, uint64);
+int vm_u_share(pagetbl_t, pagetbl_t, uint64);
+int vm_cow_fault(pagetbl_t, uint64);
 
 int copyout(pagetbl_t, uint64, char*, uint64);
 int copyinstr(pagetbl_t, char*, uint64, uint64);
@@ -110,6 +145,7 @@ void timer_init();
 void timer_create();
 void timer_update();
 uint64 timer_get_ticks();
+void timer_wait(uint64);
 
 // plic.c
 void plic_init(void);
@@ -141,20 +177,42 @@ void syscall();
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int, void (*)(struct buf *));
+void            virtio_disk_submitv(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_plug(void);
+void            virtio_disk_unplug(void);
 void            virtio_disk_intr(void);
 
 // bio.c
 void binit(void);
 struct buf* buf_read(uint, uint);
 void buf_release(struct buf*);
+struct buf* buf_get(uint, uint);
 void buf_write(struct buf*);
+void buf_readv(uint, uint*, int, struct buf**);
+void buf_writev(struct buf**, int);
+void buf_prefetch(uint, uint*, int);
+void buf_flushv(uint, uint*, int);
+void buf_sync(void);
+void buf_writeout(struct buf**, int);
+void buf_pin(struct buf*);
+void buf_unpin(struct buf*);
+void buf_flusher(void);
+void buf_stat(void);
+int buf_reclaim(int);
 
 // bitmap.c
-uint balloc(uint);
+void balloc_init(int);
+uint balloc(uint, uint);
+uint ballocn(uint, uint, uint, uint*);
+uint balloc_at(uint, uint, uint);
 void bfree(int, uint);
+void bfreen(int, uint, uint);
+uint balloc_dirgroup(void);
 
 // inode.c
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -163,14 +221,25 @@ void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, struct readahead*, uint, uint);
+void            ifsync(struct inode*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+struct buf*     ibread(struct inode*, uint, int);
 void            ireclaim(int);
 void            printi(struct inode*);
+void            istat(void);
 
 struct inode*   iget(uint, uint);
 
+// dcache.c
+void            dcache_init(void);
+int             dcache_lookup(uint, uint, char*, uint*, uint*);
+void            dcache_enter(uint, uint, char*, uint, uint);
+void            dcache_purge(uint, uint);
+void            dcache_stat(void);
+
 // dir.c
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
@@ -190,11 +259,20 @@ int             filewrite(struct file*, uint64, int n);
 // fs.c
 void            fsinit(int);
 
+// log.c
+struct superblock;
+void            initlog(int, struct superblock*);
+void            log_write(struct buf*);
+void            begin_op(void);
+void            end_op(void);
+void            log_stat(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesize(struct pipe*, int);
 
 // exec.c
 int             kexec(char*, char**);
@@ -207,8 +285,17 @@ void            consputc(int);
 // tests
 void lab2p1(void);
 void lab2p2(void);
+void bench_fork(void);
+void bench_buddy(void);
+void bench_bcache(void);
+void bench_disk(void);
+void bench_ucopy(void);
+void bench_str(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
 
+// a 64-bit word with a zero byte
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 #endif
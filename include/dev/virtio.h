@@ -47,7 +47,9 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// a request of k blocks takes k + 2, so NUM/3 single block
+// requests can be in flight. k is at most MAXBIO.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -74,8 +76,10 @@ struct virtq_used_elem {
   uint32 len;
 };
 
+#define VIRTQ_USED_F_NO_NOTIFY 1 // device does not need QUEUE_NOTIFY now
+
 struct virtq_used {
-  uint16 flags; // always zero
+  uint16 flags; // VIRTQ_USED_F_NO_NOTIFY or zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
 };
@@ -4,13 +4,18 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ra;      // prefetched by readahead, not read yet
+  int dirty;   // changed in memory, not written to disk yet
+  uint64 dirtied; // ticks when it became dirty
+  int logged;  // pinned by the log, its commit writes it
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  struct buf *next; // hash bucket chain
+  struct buf *lprev, *lnext; // free list of the bucket, if on it
+  uint64 lastuse;   // bcache.clock at the last release, for LRU
+  uchar *data;      // BSIZE bytes inside a pmem page
 };
 
 #endif
@@ -5,6 +5,13 @@
 #include "fs/stat.h"
 #include "lib/sleeplock.h"
 
+// sequential readahead state of an open file, see ireadahead().
+struct readahead {
+  uint next;  // block a sequential reader reads next
+  uint win;   // blocks to keep prefetched ahead of it, 0 if random
+  uint end;   // blocks below this were already prefetched
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
   int ref; // reference count
@@ -13,6 +20,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct readahead ra; // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -25,6 +33,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // itable hash chain
+  struct inode *prev;    // itable LRU list, while ref == 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -33,7 +44,7 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NADDRS];
 };
 
 // map major device number to device functions.
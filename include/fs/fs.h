@@ -22,13 +22,34 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_ flags below
+  uint groupsize;    // Blocks per allocation group
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define FS_EXTENT 0x1    // inodes map their first blocks with extents
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// addrs[] of an inode: NDIRECT direct blocks, then the
+// indirect block and the double-indirect block.
+#define INDIRECT  NDIRECT
+#define DINDIRECT (NDIRECT + 1)
+#define NADDRS    (NDIRECT + 2)
+
+// with FS_EXTENT the direct slots hold NEXTENT extents instead,
+// mapping the first blocks of the file. the blocks after them
+// are mapped by the indirect and double-indirect blocks, which
+// a file only uses when its blocks are too fragmented.
+struct extent {
+  uint start;         // first disk block
+  uint len;           // number of blocks, 0 if unused
+};
+#define NEXTENT (NDIRECT * sizeof(uint) / sizeof(struct extent))
 
 // On-disk inode structure
 struct dinode {
@@ -37,7 +58,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NADDRS];   // Data block addresses
 };
 
 // Inodes per block.
@@ -52,6 +73,13 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Allocation groups: the disk is split into groups of sb.groupsize
+// blocks and the inodes into as many groups of IPG inodes.
+// the blocks of a file go to the group of its inode.
+#define NGROUPS(sb)    (((sb).size + (sb).groupsize - 1) / (sb).groupsize)
+#define IPG(sb)        (((sb).ninodes + NGROUPS(sb) - 1) / NGROUPS(sb))
+#define IGROUP(i, sb)  ((i) / IPG(sb))
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -62,4 +90,31 @@ struct dirent {
   char name[DIRSIZ] __attribute__((nonstring));
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// Hashed directories (major == DIR_HASHED), for directories
+// larger than one block. They are still arrays of dirents, so
+// code that scans a directory sees the same entries; the slots
+// below have inum 0 and are skipped.
+// block 0: ".", "..", a header slot whose name[0] is the depth d,
+// then a table of 2^d bucket block numbers, DH_PERSLOT per slot,
+// indexed by the low d bits of dirhash(name).
+// every other block is a bucket: slot 0 holds its depth in name[0],
+// and its names agree on that many low bits of their hash.
+// a full bucket splits in two (extendible hashing).
+#define DIR_HASHED    1
+#define DH_HEAD       2   // header slot in block 0
+#define DH_TABLE      3   // first table slot in block 0
+#define DH_PERSLOT    3   // table entries per slot
+#define DH_MAXDEPTH   7   // 128 buckets of DPB-1 names
+
+static inline uint dirhash(const char *name) {
+  uint h = 2166136261u;
+
+  for (int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619u;
+  return h;
+}
+
 #endif
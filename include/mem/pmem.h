@@ -2,20 +2,50 @@
 #define PMEM_H
 
 #include "lib/spinlock.h"
+#include "param.h"
 #include "types.h"
+#include "defs.h"
 
+// lives in the first page of a free block
 typedef struct page_node {
   struct page_node *next;
+  struct page_node *prev;
 } page_node_t;
 
+// a buddy allocator over [begin, end).
+// block offsets are counted in pages from begin, a block of order k
+// starts at a multiple of 2^k pages.
 typedef struct alloc_region {
   uint64 begin;
   uint64 end;
   spinlock_t lock;
-  uint32 num;
-  page_node_t *free_list;
+  uint32 num;                                   // free pages
+  page_node_t *free_area[PMEM_MAX_ORDER + 1];   // free blocks of each order
+  uint32 nfree[PMEM_MAX_ORDER + 1];             // length of each free_area list
 } alloc_region_t;
 
-static alloc_region_t kern_region, user_region;
+// per-hart cache of free pages in front of a region's free list.
+// only touched by its own hart with interrupts off, so no lock.
+typedef struct page_cache {
+  page_node_t *list;
+  uint32 num;
+  page_node_t *zlist; // pages zeroed by the idle loop
+  uint32 znum;
+
+  // statistics
+  uint64 hits;        // served from the cache
+  uint64 refills;     // batches taken from the region
+  uint64 drains;      // batches given back to the region
+  uint64 lock_waits;  // region lock found busy on refill/drain
+  uint64 zhits;       // PMEM_ZERO served from zlist
+  uint64 zmisses;     // PMEM_ZERO zeroed on demand
+} page_cache_t;
+
+// cached pages moved from/to the region per refill/drain
+#define PCP_BATCH 16
+// drain when a cache holds more than this many pages
+#define PCP_HIGH  (4 * PCP_BATCH)
+// pre-zeroed pages the idle loop keeps per hart
+#define ZPOOL_HIGH 32
 
-#endif
\ No newline at end of file
+#endif
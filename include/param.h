@@ -7,19 +7,27 @@
 // maximum number of processes
 #define NPROC 64
 
+#define TICK    1000000  // time units between timer interrupts
+
 #define USERSTACK    1     // user stack pages
 
 // file system
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE_MIN   50  // inode cache never smaller than this
+#define NINODES    2048  // inodes in the file system, also the inode cache max
+#define MAXGROUPS    64  // max allocation groups of a file system
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NBUF_MIN     (LOGBLOCKS+MAXBIO*2)  // disk block cache never shrinks below this
+#define NBUF_MAX     8192  // max size of disk block cache
+#define MAXBIO       16  // max adjacent blocks in one disk request
+#define RA_MIN        4  // initial readahead window in blocks
+#define RA_MAX       64  // max readahead window in blocks
+#define FSSIZE       32768  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 
 #endif
@@ -66,7 +66,7 @@ typedef struct trapframe {
 } trapframe_t;
 
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE};
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE};
 // The memory layout of a process:
 //   trampoline
 //   trapframe
@@ -80,6 +80,7 @@ typedef struct proc {
     int pid;
     enum procstate state;  // process state
     void *chan;            // sleeping on chan
+    struct proc *sqnext;   // next on chan's sleep queue
     int killed;
     int xstate;            // exit status to be returned to parent's wait
     
@@ -95,6 +96,17 @@ typedef struct proc {
 
     uint64 kstack;
     context_t ctx;
+
+    void (*kfn)(void);  // entry of a kernel thread, 0 for user processes
+
+    int cpu;               // hart whose run queue it goes on
+    struct proc *rqnext;   // next on that run queue
+    uint64 rqtime;         // r_time() when it became RUNNABLE
+
+    int nice;              // -20 (largest cpu share) to 19
+    uint64 vruntime;       // cpu time, scaled by NICE0_WEIGHT / weight
+    uint64 runtime;        // cpu time, in time units
+    uint64 lastrun;        // r_time() when last charged
 } proc_t;
 
 // Per-CPU state.
@@ -21,9 +21,12 @@ void main() {
         proc_init();
         binit();
         iinit();
+        dcache_init();
         fileinit();
         virtio_disk_init();
         init_zero();
+        if (kthread_create(buf_flusher) < 0)
+            panic("buf_flusher");
 
         printf("cpu %d is booting!\n", cpuid);
         __sync_synchronize();
@@ -16,6 +16,11 @@ start()
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
   x |= MSTATUS_MPP_S;
+  // turn on the vector unit if the hart has one, for str.c.
+  if(r_misa() & MISA_EXT('V')){
+    x |= MSTATUS_VS_INIT;
+    str_rvv = 1;
+  }
   w_mstatus(x);
 
   // set M Exception Program Counter to main, for mret.
@@ -1,4 +1,5 @@
 #include "types.h"
+#include "param.h"
 #include "defs.h"
 #include "riscv.h"
 #include "dev/timer.h"
@@ -15,11 +16,14 @@ timerinit()
   // enable the sstc extension (i.e. stimecmp).
   w_menvcfg(r_menvcfg() | (1L << 63)); 
   
-  // allow supervisor to use stimecmp and time.
-  w_mcounteren(r_mcounteren() | 2);
+  // allow supervisor to use stimecmp, time and cycle.
+  w_mcounteren(r_mcounteren() | 3);
+
+  // allow user mode to read time too, for benchmarks.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICK);
 }
 
 // create a timer for each hart
@@ -31,6 +35,18 @@ void timer_create() {
 void timer_update() {
     acquire(&timer.lk);
     timer.ticks++;
+    wakeup(&timer.ticks);
+    release(&timer.lk);
+}
+
+// sleep for n ticks.
+void timer_wait(uint64 n) {
+    uint64 t0;
+
+    acquire(&timer.lk);
+    t0 = timer.ticks;
+    while (timer.ticks - t0 < n)
+        sleep(&timer.ticks, &timer.lk);
     release(&timer.lk);
 }
 
@@ -40,16 +40,23 @@ static struct disk {
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
+  int nfree;       // how many are
   uint16 used_idx; // we've looked this far in used[2..NUM].
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXBIO]; // adjacent blocks, b[0] first
+    int n;
+    void (*done)(struct buf *);
     char status;
   } info[NUM];
 
+  // QUEUE_NOTIFY batching, see virtio_disk_plug().
+  int plugged;     // nesting depth of plug calls
+  int unnotified;  // requests in avail the device was not told about
+
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
@@ -118,14 +125,11 @@ virtio_disk_init(void)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = pmem_alloc(0);
-  disk.avail = pmem_alloc(0);
-  disk.used = pmem_alloc(0);
+  disk.desc = pmem_alloc(0 | PMEM_ZERO);
+  disk.avail = pmem_alloc(0 | PMEM_ZERO);
+  disk.used = pmem_alloc(0 | PMEM_ZERO);
   if(!disk.desc || !disk.avail || !disk.used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
@@ -144,6 +148,7 @@ virtio_disk_init(void)
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
     disk.free[i] = 1;
+  disk.nfree = NUM;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -159,6 +164,7 @@ alloc_desc()
   for(int i = 0; i < NUM; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
+      disk.nfree--;
       return i;
     }
   }
@@ -178,7 +184,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  disk.nfree++;
 }
 
 // free a chain of descriptors.
@@ -194,14 +200,16 @@ free_chain(int i)
     else
       break;
   }
+  // one waiter at a time, see virtio_disk_submitv
+  wakeup_one(&disk.free[0]);
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a transfer of k blocks uses k + 2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +220,82 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// tell the device about the avail ring entries it has not seen.
+// caller holds vdisk_lock.
+static void
+kick(void)
+{
+  if(disk.unnotified == 0)
+    return;
+  disk.unnotified = 0;
+  __sync_synchronize();
+  if((disk.used->flags & VIRTQ_USED_F_NO_NOTIFY) == 0)
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// hold back QUEUE_NOTIFY until the matching virtio_disk_unplug(),
+// so a batch of submits costs one notification (one vm exit).
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_plug(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  acquire(&disk.vdisk_lock);
+  disk.plugged++;
+  release(&disk.vdisk_lock);
+}
+
+void
+virtio_disk_unplug(void)
+{
+  acquire(&disk.vdisk_lock);
+  if(--disk.plugged == 0)
+    kick();
+  release(&disk.vdisk_lock);
+}
+
+// queue a read or write of the n bufs in bs, which must hold
+// adjacent blocks in order, as one request, and return without
+// waiting for it.
+// each b->disk stays 1 until the request completes, then done(b)
+// is called for each buf if done is non-zero. done runs in the
+// disk interrupt with vdisk_lock held, so it must not sleep or
+// submit. use virtio_disk_wait() to wait for a buf instead.
+// sleeps only if the descriptors are taken.
+void
+virtio_disk_submitv(struct buf **bs, int n, int write, void (*done)(struct buf *))
+{
+  uint64 sector;
+
+  if(n < 1 || n > MAXBIO)
+    panic("virtio_disk_submitv: n");
+  sector = bs[0]->blockno * (BSIZE / 512);
+  for(int i = 1; i < n; i++){
+    if(bs[i]->blockno != bs[0]->blockno + i)
+      panic("virtio_disk_submitv: not adjacent");
+  }
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // one descriptor for type/reserved/sector, then the data,
+  // then one for a 1-byte status result.
+  // the data may be split over a chain of descriptors,
+  // one per buf here.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the n + 2 descriptors.
+  int idx[MAXBIO + 2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n + 2) == 0) {
       break;
     }
+    // the requests holding the descriptors may not be notified yet
+    kick();
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
+  // leave what is left to the next waiter
+  if(disk.nfree > 0)
+    wakeup_one(&disk.free[0]);
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +312,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record struct bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    bs[i]->disk = 1;
+    disk.info[idx[0]].b[i] = bs[i];
+  }
+  disk.info[idx[0]].n = n;
+  disk.info[idx[0]].done = done;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -276,21 +345,44 @@ virtio_disk_rw(struct buf *b, int write)
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
-  __sync_synchronize();
+  disk.unnotified++;
+  if(disk.plugged == 0)
+    kick();
+
+  release(&disk.vdisk_lock);
+}
+
+// queue a read or write of b, see virtio_disk_submitv().
+void
+virtio_disk_submit(struct buf *b, int write, void (*done)(struct buf *))
+{
+  virtio_disk_submitv(&b, 1, write, done);
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// wait for a request queued by virtio_disk_submit() to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+
+  // a plugged request would never start
+  kick();
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write, 0);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -316,9 +408,18 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    void (*done)(struct buf *) = disk.info[id].done;
+    disk.info[id].done = 0;
+    free_chain(id);
+
+    for(int i = 0; i < disk.info[id].n; i++){
+      struct buf *b = disk.info[id].b[i];
+      disk.info[id].b[i] = 0;
+      b->disk = 0;   // disk is done with buf
+      if(done)
+        done(b);
+      wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
@@ -2,6 +2,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "lib/spinlock.h"
 #include "fs/buf.h"
 #include "fs/fs.h"
 
@@ -12,48 +13,250 @@ static void bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = buf_read(dev, bno);
+  bp = buf_get(dev, bno);
   memset(bp->data, 0, BSIZE);
-  buf_write(bp);
+  log_write(bp);
   buf_release(bp);
 }
 
-// allocate a zeroed disk block
-// returns 0 if out of disk space
-uint balloc(uint dev) {
-    int b, bi, m;
+// in-memory copy of the free bitmap, built at mount, so
+// allocation never reads bitmap blocks. a bit of map is set
+// if the block is in use, in the same order as on disk.
+// a bit of sum is set if that word of map has a free block,
+// so a search skips 64 full words at a time.
+// balloc and bfree change both copies, the disk one through the log.
+#define MAPWORDS ((FSSIZE + 63) / 64)
+#define SUMWORDS ((MAPWORDS + 63) / 64)
+
+static struct {
+    spinlock_t lock;
+    uint64 map[MAPWORDS];
+    uint64 sum[SUMWORDS];
+    uint nfree;
+    uint gfree[MAXGROUPS]; // free blocks per allocation group
+    uint ngroups;
+    uint rotor;            // group of the last new directory
+} fmap;
+
+static void sum_update(int w) {
+    if (~fmap.map[w])
+        fmap.sum[w / 64] |= 1UL << (w % 64);
+    else
+        fmap.sum[w / 64] &= ~(1UL << (w % 64));
+}
+
+// read the bitmap blocks into fmap.
+// called by fsinit after the log is recovered.
+void balloc_init(int dev) {
     struct buf *bp;
+    uint b, n;
+    int w;
+
+    if (sb.size > FSSIZE)
+        panic("balloc_init: disk too big");
+    if ((fmap.ngroups = NGROUPS(sb)) > MAXGROUPS)
+        panic("balloc_init: too many groups");
 
-    bp = 0;
+    initlock(&fmap.lock, "fmap");
     for (b = 0; b < sb.size; b += BPB) {
+        n = sb.size - b < BPB ? sb.size - b : BPB;
         bp = buf_read(dev, BBLOCK(b, sb));
-        for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
+        memmove((uchar*)fmap.map + b / 8, bp->data, (n + 7) / 8);
+        buf_release(bp);
+    }
+    // the bits past the end of the disk are in use
+    for (b = sb.size; b < MAPWORDS * 64; b++)
+        fmap.map[b / 64] |= 1UL << (b % 64);
+
+    fmap.nfree = 0;
+    for (w = 0; w < MAPWORDS; w++) {
+        sum_update(w);
+        for (uint64 x = ~fmap.map[w]; x; x &= x - 1) {
+            fmap.gfree[(w * 64 + ctz64(x)) / sb.groupsize]++;
+            fmap.nfree++;
+        }
+    }
+}
+
+// the first free block at or after b, or -1.
+static int next_free(uint b) {
+    uint w = b / 64, sw;
+    uint64 x;
+
+    if (b >= sb.size)
+        return -1;
+    if ((x = ~fmap.map[w] & (~0UL << (b % 64))) != 0)
+        return w * 64 + ctz64(x);
+
+    // the next word with a free block, through sum
+    w++;
+    for (sw = w / 64; sw < SUMWORDS; sw++) {
+        x = fmap.sum[sw];
+        if (sw == w / 64)
+            x &= ~0UL << (w % 64);
+        if (x) {
+            w = sw * 64 + ctz64(x);
+            return w * 64 + ctz64(~fmap.map[w]);
+        }
+    }
+    return -1;
+}
+
+// the number of free blocks from b on, up to max.
+static uint run_len(uint b, uint max) {
+    uint n = 0, k;
+    uint64 x;
+
+    while (n < max && b < sb.size) {
+        x = fmap.map[b / 64] >> (b % 64);
+        k = x ? ctz64(x) : 64 - b % 64;
+        if (k > 64 - b % 64)
+            k = 64 - b % 64;
+        n += k;
+        b += k;
+        if (k == 0 || b % 64 != 0)
+            break;
+    }
+    return n < max ? n : max;
+}
+
+// set blocks b..b+n-1 in use or free in fmap.
+static void fmap_mark(uint b, uint n, int used) {
+    for (uint i = b; i < b + n; i++) {
+        if (used) {
+            fmap.map[i / 64] |= 1UL << (i % 64);
+            fmap.gfree[i / sb.groupsize]--;
+        } else {
+            fmap.map[i / 64] &= ~(1UL << (i % 64));
+            fmap.gfree[i / sb.groupsize]++;
+        }
+        if (i % 64 == 63 || i == b + n - 1)
+            sum_update(i / 64);
+    }
+    if (used)
+        fmap.nfree -= n;
+    else
+        fmap.nfree += n;
+}
+
+// set blocks b..b+n-1 in use or free in the bitmap blocks.
+static void bmark(uint dev, uint b, uint n, int used) {
+    struct buf *bp;
+    uint i, bi;
+    int m;
+
+    for (i = b; i < b + n; ) {
+        bp = buf_read(dev, BBLOCK(i, sb));
+        do {
+            bi = i % BPB;
             m = 1 << (bi % 8);
-            if((bp->data[bi/8] & m) == 0) {
+            if (((bp->data[bi/8] & m) != 0) == used)
+                panic(used ? "bmark: block in use" : "freeing free block");
+            if (used)
                 bp->data[bi/8] |= m;  // Mark block in use.
-                buf_write(bp);
-                buf_release(bp);
-                bzero(dev, b + bi);
-                return b + bi;
+            else
+                bp->data[bi/8] &= ~m;
+            i++;
+        } while (i < b + n && i % BPB != 0);
+        log_write(bp);
+        buf_release(bp);
+    }
+}
+
+// allocate up to n contiguous zeroed blocks: the first free run
+// of n blocks at or after goal, wrapping around the disk, or the
+// longest run shorter than n if there is none.
+// sets *got to the number allocated.
+// returns the first block, 0 if out of disk space
+uint ballocn(uint dev, uint goal, uint n, uint *got) {
+    uint best = 0, bestlen = 0, len = 0, end, i;
+    int b, pass;
+
+    if (goal >= sb.size)
+        goal = 0;
+
+    acquire(&fmap.lock);
+    for (pass = 0; pass < 2 && bestlen < n; pass++) {
+        end = pass == 0 ? sb.size : goal;
+        for (b = next_free(pass == 0 ? goal : 0); b >= 0 && b < end; b = next_free(b + len)) {
+            len = run_len(b, n);
+            if (len > bestlen) {
+                best = b;
+                bestlen = len;
+                if (len == n)
+                    break;
             }
         }
-        buf_release(bp);
     }
-    printf("balloc: out of blocks\n");
-    return 0;
+    if (bestlen > 0)
+        fmap_mark(best, bestlen, 1);
+    release(&fmap.lock);
+
+    if (bestlen == 0) {
+        printf("balloc: out of blocks\n");
+        return 0;
+    }
+    bmark(dev, best, bestlen, 1);
+    for (i = 0; i < bestlen; i++)
+        bzero(dev, best + i);
+    *got = bestlen;
+    return best;
+}
+
+// allocate a zeroed disk block, the first free one at or after goal
+// returns 0 if out of disk space
+uint balloc(uint dev, uint goal) {
+    uint got;
+
+    return ballocn(dev, goal, 1, &got);
+}
+
+// allocate the free blocks among b..b+n-1 that follow b
+// without a gap, zeroed.
+// returns the number allocated, 0 if b is in use.
+uint balloc_at(uint dev, uint b, uint n) {
+    uint len, i;
+
+    acquire(&fmap.lock);
+    if ((len = run_len(b, n)) > 0)
+        fmap_mark(b, len, 1);
+    release(&fmap.lock);
+
+    if (len == 0)
+        return 0;
+    bmark(dev, b, len, 1);
+    for (i = 0; i < len; i++)
+        bzero(dev, b + i);
+    return len;
+}
+
+// the allocation group for a new directory: the next one after
+// the last directory's with at least the average number of free
+// blocks, so directories, and the files in them, spread out.
+uint balloc_dirgroup(void) {
+    uint g, i;
+
+    acquire(&fmap.lock);
+    g = fmap.rotor;
+    for (i = 1; i <= fmap.ngroups; i++) {
+        g = (fmap.rotor + i) % fmap.ngroups;
+        if (fmap.gfree[g] * fmap.ngroups >= fmap.nfree)
+            break;
+    }
+    fmap.rotor = g;
+    release(&fmap.lock);
+    return g;
+}
+
+// free the n disk blocks from b on
+void bfreen(int dev, uint b, uint n) {
+    bmark(dev, b, n, 0);
+    acquire(&fmap.lock);
+    fmap_mark(b, n, 0);
+    release(&fmap.lock);
 }
 
 // free a disk block
 void bfree(int dev, uint b) {
-    struct buf *bp;
-    int bi, m;
-
-    bp = buf_read(dev, BBLOCK(b, sb));
-    bi = b % BPB;
-    m = 1 << (bi % 8);
-    if((bp->data[bi/8] & m) == 0)
-        panic("freeing free block");
-    bp->data[bi/8] &= ~m;
-    buf_write(bp);
-    buf_release(bp);
+    bfreen(dev, b, 1);
 }
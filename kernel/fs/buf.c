@@ -9,68 +9,346 @@
 #include "fs/fs.h"
 #include "fs/buf.h"
 
+// buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups on different blocks
+// do not contend.
+// a miss takes a free buffer (refcnt == 0) with the oldest
+// lastuse, first from its own bucket, then from the others.
+// each bucket keeps its unused clean buffers on a free list,
+// empty ones first, then by release order, so the victim of a
+// bucket is the head of its list and no chain is scanned.
+#define NBUCKET 2039    // prime near NBUF_MAX / 4
+
+// the block data lives in pmem user pages, BPP buffers per page.
+// the cache starts at 1/BUF_FRAC of free user memory, grows on a
+// miss while more than BUF_RESERVE user pages are free, and gives
+// pages back through buf_reclaim when user memory runs out.
+#define BPP         (PGSIZE / BSIZE)
+#define NGROUP      (NBUF_MAX / BPP)
+#define BUF_FRAC    16
+#define BUF_RESERVE 1024
+#define BUF_RECLAIM 16   // max pages per buf_reclaim call
+
+// buf_write only marks a buffer dirty. the flusher thread wakes
+// every FLUSH_TICKS and writes back the buffers dirty for
+// DIRTY_TICKS or more, or all of them when more than 1/DIRTY_FRAC
+// of the cache is dirty, FLUSH_BATCH at a time in block order.
+// a dirty buffer is not evicted or reclaimed until it is written.
+#define FLUSH_TICKS 5
+#define DIRTY_TICKS 30
+#define DIRTY_FRAC  4
+#define FLUSH_BATCH 64
+
+struct bucket {
+    spinlock_t lock;
+    struct buf *head;   // hash chain
+    struct buf *lru;    // free list, least recently used first
+    struct buf *mru;    // its tail
+
+    // statistics, protected by lock
+    uint64 hits;
+    uint64 misses;
+    uint64 evictions;
+    uint64 ra_hits;     // prefetched blocks that were then read
+    uint64 ra_waste;    // prefetched blocks evicted unread
+};
+
 struct {
+    // serializes evictions, growing and shrinking, so at most one
+    // hart holds more than one bucket lock at a time
     spinlock_t lock;
-    struct buf buf[NBUF];
+    struct buf buf[NBUF_MAX];
+    struct bucket bucket[NBUCKET];
 
-    // double linked list of all buffers
-    struct buf head;
+    // data page of buf[i*BPP .. (i+1)*BPP), 0 if not in use
+    void *page[NGROUP];
+    int nbuf;
+
+    // bumped on every release, orders buffers for LRU
+    uint64 clock;
+
+    // statistics, protected by lock
+    uint64 grows;
+    uint64 shrinks;
+    uint64 ra_issued;   // blocks prefetched, updated atomically
+    uint64 writebacks;  // dirty buffers written, updated atomically
+
+    int ndirty;         // dirty buffers, updated atomically
 } bcache;
 
+static inline struct bucket* hash(uint dev, uint blockno) {
+    return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// put b on the free list of bk, bk->lock must be held.
+// empty buffers go first, they are the cheapest to reuse.
+static void lru_add(struct bucket *bk, struct buf *b) {
+    if (!b->valid) {
+        b->lprev = 0;
+        b->lnext = bk->lru;
+        if (bk->lru)
+            bk->lru->lprev = b;
+        else
+            bk->mru = b;
+        bk->lru = b;
+    } else {
+        b->lnext = 0;
+        b->lprev = bk->mru;
+        if (bk->mru)
+            bk->mru->lnext = b;
+        else
+            bk->lru = b;
+        bk->mru = b;
+    }
+}
+
+static void lru_remove(struct bucket *bk, struct buf *b) {
+    if (b->lprev)
+        b->lprev->lnext = b->lnext;
+    else
+        bk->lru = b->lnext;
+    if (b->lnext)
+        b->lnext->lprev = b->lprev;
+    else
+        bk->mru = b->lprev;
+    b->lprev = b->lnext = 0;
+}
+
+// add one data page worth of empty buffers to bucket bk.
+// bcache.lock and bk->lock must be held.
+// returns one of the new buffers, or 0 if there is no memory.
+static struct buf* buf_grow(struct bucket *bk) {
+    struct buf *b = 0;
+    char *page;
+    int g;
+
+    for (g = 0; g < NGROUP; g++) {
+        if (bcache.page[g] == 0)
+            break;
+    }
+    if (g == NGROUP)
+        return 0;
+    if ((page = pmem_alloc(1 | PMEM_NOFILL)) == 0)
+        return 0;
+
+    bcache.page[g] = page;
+    for (int i = 0; i < BPP; i++) {
+        b = &bcache.buf[g * BPP + i];
+        b->data = (uchar*)(page + i * BSIZE);
+        b->valid = 0;
+        b->refcnt = 0;
+        b->lastuse = 0;
+        b->next = bk->head;
+        bk->head = b;
+        lru_add(bk, b);
+    }
+    bcache.nbuf += BPP;
+    bcache.grows++;
+    return b;
+}
+
 void binit(void) {
-    struct buf *b;
+    int i, n;
 
     initlock(&bcache.lock, "bcache");
+    for (i = 0; i < NBUCKET; i++)
+        initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    for (i = 0; i < NBUF_MAX; i++)
+        initsleeplock(&bcache.buf[i].lock, "buffer");
+
+    // size the cache from the free memory, spread over the buckets
+    n = pmem_nfree(1) / BUF_FRAC;
+    if (n < NBUF_MIN / BPP)
+        n = NBUF_MIN / BPP;
+    if (n > NGROUP / 2)
+        n = NGROUP / 2;
+    acquire(&bcache.lock);
+    for (i = 0; i < n; i++) {
+        struct bucket *bk = &bcache.bucket[i % NBUCKET];
+        acquire(&bk->lock);
+        if (buf_grow(bk) == 0)
+            panic("binit");
+        release(&bk->lock);
+    }
+    bcache.grows = 0;
+    release(&bcache.lock);
+}
+
+// look up (dev, blockno) in bucket bk, bk->lock must be held.
+static struct buf* bucket_find(struct bucket *bk, uint dev, uint blockno) {
+    struct buf *b;
+
+    for (b = bk->head; b; b = b->next) {
+        if (b->dev == dev && b->blockno == blockno)
+            return b;
+    }
+    return 0;
+}
 
-    // Create linked list of buffers
-    bcache.head.prev = &bcache.head;
-    bcache.head.next = &bcache.head;
-    for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
-        initsleeplock(&b->lock, "buffer");
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
+// least recently used free buffer of bucket bk, bk->lock must be held.
+// a free buffer holding no block is returned first.
+// dirty buffers are never on the free list.
+static struct buf* bucket_lru(struct bucket *bk) {
+    return bk->lru;
+}
+
+// take a reference to cached b, bk->lock must be held.
+static void buf_ref(struct bucket *bk, struct buf *b) {
+    if (b->refcnt++ == 0 && !b->dirty)
+        lru_remove(bk, b);
+}
+
+static void bucket_remove(struct bucket *bk, struct buf *b) {
+    struct buf **pp;
+
+    for (pp = &bk->head; *pp; pp = &(*pp)->next) {
+        if (*pp == b) {
+            *pp = b->next;
+            return;
+        }
     }
+    panic("bucket_remove");
 }
 
+static int buf_flush(int max, uint64 before);
+
 // bget
 // helper function
-static struct buf* bget(uint dev, uint blockno) {
+// with ra set (readahead), return 0 instead if the block is
+// already cached, and mark the new buffer as prefetched.
+static struct buf* bget(uint dev, uint blockno, int ra) {
+    struct bucket *bk = hash(dev, blockno);
+    struct bucket *vbk;
     struct buf *b;
+    int i;
 
-    acquire(&bcache.lock);
+    acquire(&bk->lock);
 
     // check if the block already cached
-    for(b = bcache.head.next; b != &bcache.head; b = b->next){
-        if(b->dev == dev && b->blockno == blockno){
-            b->refcnt++;
-            release(&bcache.lock);
-            acquiresleep(&b->lock);
-            return b;
+    if ((b = bucket_find(bk, dev, blockno)) != 0) {
+        if (ra) {
+            release(&bk->lock);
+            return 0;
+        }
+        buf_ref(bk, b);
+        bk->hits++;
+        if (b->ra) {
+            b->ra = 0;
+            bk->ra_hits++;
         }
+        release(&bk->lock);
+        acquiresleep(&b->lock);
+        return b;
     }
+    if (!ra)
+        bk->misses++;
 
-    // not cached. LRU strategy.
-    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-        if(b->refcnt == 0) {
-            b->dev = dev;
-            b->blockno = blockno;
-            b->valid = 0;
-            b->refcnt = 1;
+    // not cached, take an empty buffer of this bucket if there is one
+    if ((b = bucket_lru(bk)) != 0 && !b->valid) {
+        lru_remove(bk, b);
+        goto found;
+    }
+    release(&bk->lock);
+
+slow:
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+
+    // someone may have cached the block or freed a buffer here meanwhile
+    if ((b = bucket_find(bk, dev, blockno)) != 0) {
+        if (ra) {
+            release(&bk->lock);
             release(&bcache.lock);
-            acquiresleep(&b->lock);
-            return b;
+            return 0;
+        }
+        buf_ref(bk, b);
+        if (b->ra) {
+            b->ra = 0;
+            bk->ra_hits++;
+        }
+        release(&bk->lock);
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+    }
+    b = bucket_lru(bk);
+
+    // grow rather than evict while memory is plentiful
+    if ((b == 0 || b->valid) && pmem_nfree(1) > BUF_RESERVE) {
+        struct buf *nb = buf_grow(bk);
+        if (nb)
+            b = nb;
+    }
+    if (b) {
+        lru_remove(bk, b);
+        release(&bcache.lock);
+        goto found;
+    }
+
+    // steal the least recently used free buffer of another bucket.
+    // peek at the list heads without the locks, then lock the best
+    // bucket and take its head, looking again if it has gone.
+    // bcache.lock keeps other harts from stealing meanwhile.
+    for (;;) {
+        uint64 oldest = 0;
+
+        vbk = 0;
+        for (i = 0; i < NBUCKET; i++) {
+            struct bucket *o = &bcache.bucket[i];
+            struct buf *c = *(struct buf * volatile *)&o->lru;
+
+            if (o == bk || c == 0)
+                continue;
+            if (vbk == 0 || c->lastuse < oldest) {
+                vbk = o;
+                oldest = c->lastuse;
+            }
         }
+        if (vbk == 0)
+            break;
+        acquire(&vbk->lock);
+        if ((b = bucket_lru(vbk)) != 0)
+            break;
+        release(&vbk->lock);
+    }
+    if (b == 0) {
+        // every unused buffer is dirty, write some back and retry
+        release(&bk->lock);
+        release(&bcache.lock);
+        if (ra)
+            return 0;
+        if (buf_flush(FLUSH_BATCH, timer_get_ticks()) == 0)
+            panic("bget: no buffers");
+        goto slow;
     }
 
-    panic("bget: no buffers");
+    lru_remove(vbk, b);
+    bucket_remove(vbk, b);
+    release(&vbk->lock);
+    b->next = bk->head;
+    bk->head = b;
+    release(&bcache.lock);
+
+found:
+    if (b->valid) {
+        bk->evictions++;
+        if (b->ra)
+            bk->ra_waste++;
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->ra = ra;
+    b->refcnt = 1;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
 }
 
 struct buf* buf_read(uint dev, uint blockno) {
     struct buf *b;
 
-    b = bget(dev, blockno);
+    b = bget(dev, blockno, 0);
     if (!b->valid) {
         virtio_disk_rw(b, 0);
         b->valid = 1;
@@ -78,11 +356,93 @@ struct buf* buf_read(uint dev, uint blockno) {
     return b;
 }
 
+// return a locked buffer for blockno without reading the disk.
+// the caller overwrites all of b->data.
+struct buf* buf_get(uint dev, uint blockno) {
+    struct buf *b;
+
+    b = bget(dev, blockno, 0);
+    b->valid = 1;
+    return b;
+}
+
+// mark b dirty, the flusher or a sync writes it to disk later.
+// a block in the log is written by the commit instead.
 void buf_write(struct buf *b) {
     if (!holdingsleep(&b->lock)) {
         panic("buf_write");
     }
-    virtio_disk_rw(b, 1);
+    if (!b->dirty && !b->logged) {
+        b->dirty = 1;
+        b->dirtied = timer_get_ticks();
+        __sync_fetch_and_add(&bcache.ndirty, 1);
+    }
+}
+
+// do bps[0..n) on the disk with as few requests as possible,
+// one per run of adjacent blocks, and wait for all of them.
+static void buf_rwv(struct buf **bps, int n, int write) {
+    int i, j;
+
+    virtio_disk_plug();
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && j - i < MAXBIO; j++) {
+            if (bps[j]->dev != bps[i]->dev || bps[j]->blockno != bps[j-1]->blockno + 1)
+                break;
+        }
+        virtio_disk_submitv(bps + i, j - i, write, 0);
+    }
+    virtio_disk_unplug();
+
+    for (i = 0; i < n; i++)
+        virtio_disk_wait(bps[i]);
+}
+
+// read n blocks at once into bps[0..n), locked.
+// blocks missing from the cache that are adjacent on disk
+// are read with one request.
+// the blocks must be in the order a file reads them,
+// so two callers cannot lock them in opposite orders.
+void buf_readv(uint dev, uint *blocknos, int n, struct buf **bps) {
+    struct buf *miss[MAXBIO];
+    int i, nmiss = 0;
+
+    if (n > MAXBIO)
+        panic("buf_readv");
+
+    for (i = 0; i < n; i++) {
+        bps[i] = bget(dev, blocknos[i], 0);
+        if (!bps[i]->valid)
+            miss[nmiss++] = bps[i];
+    }
+    if (nmiss == 0)
+        return;
+
+    buf_rwv(miss, nmiss, 0);
+    for (i = 0; i < nmiss; i++)
+        miss[i]->valid = 1;
+}
+
+// mark n locked buffers dirty.
+void buf_writev(struct buf **bps, int n) {
+    for (int i = 0; i < n; i++)
+        buf_write(bps[i]);
+}
+
+// drop a reference to b after its sleep-lock is released.
+static void buf_unref(struct buf *b) {
+    struct bucket *bk;
+
+    // the buffer cannot move to another bucket while refcnt > 0
+    bk = hash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    b->refcnt--;
+    if (b->refcnt == 0) {
+        b->lastuse = __sync_add_and_fetch(&bcache.clock, 1);
+        if (!b->dirty)
+            lru_add(bk, b);
+    }
+    release(&bk->lock);
 }
 
 void buf_release(struct buf *b) {
@@ -90,32 +450,352 @@ void buf_release(struct buf *b) {
         panic("buf_release");
 
     releasesleep(&b->lock);
+    buf_unref(b);
+}
 
-    acquire(&bcache.lock);
+// disk completion of a prefetched buffer, in the disk interrupt.
+// the prefetching process may be gone, so the buffer is unlocked
+// here without the holdingsleep check.
+static void prefetch_done(struct buf *b) {
+    b->valid = 1;
+    releasesleep(&b->lock);
+    buf_unref(b);
+}
+
+// start reading the n blocks of blocknos that are not cached yet
+// and return without waiting. adjacent blocks go in one request.
+// a later buf_read of such a block waits on its sleep-lock until
+// the read is done.
+void buf_prefetch(uint dev, uint *blocknos, int n) {
+    struct buf *bps[MAXBIO];
+    int i, j, k = 0;
+
+    if (n > MAXBIO)
+        panic("buf_prefetch");
+
+    for (i = 0; i < n; i++) {
+        if ((bps[k] = bget(dev, blocknos[i], 1)) != 0)
+            k++;
+    }
+    if (k == 0)
+        return;
+    __sync_fetch_and_add(&bcache.ra_issued, k);
+
+    virtio_disk_plug();
+    for (i = 0; i < k; i = j) {
+        for (j = i + 1; j < k; j++) {
+            if (bps[j]->blockno != bps[j-1]->blockno + 1)
+                break;
+        }
+        virtio_disk_submitv(bps + i, j - i, 0, prefetch_done);
+    }
+    virtio_disk_unplug();
+}
+
+/*** write-back ***/
+
+// sort bps[0..n) by block number, so adjacent blocks become runs.
+static void sort_bufs(struct buf **bps, int n) {
+    struct buf *b;
+    int i, j;
+
+    for (i = 1; i < n; i++) {
+        b = bps[i];
+        for (j = i; j > 0 && (bps[j-1]->dev > b->dev ||
+             (bps[j-1]->dev == b->dev && bps[j-1]->blockno > b->blockno)); j--)
+            bps[j] = bps[j-1];
+        bps[j] = b;
+    }
+}
+
+// pin and lock b if it is dirty since before or earlier and
+// nobody uses it. bk->lock must be held.
+//
+// this takes a sleep-lock under a spinlock, which is only safe
+// because it never sleeps: everyone who locks a buf takes a ref
+// under bk->lock first (buf_read, buf_get, buf_prefetch) and drops
+// it only after releasing the sleep-lock (buf_release,
+// prefetch_done), so refcnt 0 under bk->lock means nobody holds
+// or waits for b->lock. flush_one's way, dropping bk->lock first,
+// does not fit here: the callers lock a batch, and waiting for
+// one buf while holding the others could deadlock.
+static int grab_dirty(struct buf *b, uint64 before) {
+    if (!b->dirty || b->refcnt != 0 || b->dirtied > before)
+        return 0;
+    if (b->lock.locked)
+        panic("grab_dirty: unused buf is locked");
+    b->refcnt = 1;
+    acquiresleep(&b->lock);
+    return 1;
+}
+
+// write the n locked, pinned dirty buffers in block order,
+// adjacent blocks in one request, then clean and release them.
+static void flush_locked(struct buf **bps, int n) {
+    int i;
+
+    sort_bufs(bps, n);
+    buf_rwv(bps, n, 1);
+
+    for (i = 0; i < n; i++) {
+        bps[i]->dirty = 0;
+        __sync_fetch_and_sub(&bcache.ndirty, 1);
+        buf_release(bps[i]);
+    }
+    __sync_fetch_and_add(&bcache.writebacks, n);
+}
+
+// write back b, which is dirty and may be in use.
+// called with bk->lock held, releases it.
+// may sleep, so the caller must hold no other buffer.
+static void flush_one(struct bucket *bk, struct buf *b) {
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    if (b->dirty) {
+        virtio_disk_rw(b, 1);
+        b->dirty = 0;
+        __sync_fetch_and_sub(&bcache.ndirty, 1);
+        __sync_fetch_and_add(&bcache.writebacks, 1);
+    }
+    buf_release(b);
+}
+
+// write back up to max unused buffers dirty since before or earlier.
+// returns the number written.
+static int buf_flush(int max, uint64 before) {
+    struct buf *bps[FLUSH_BATCH];
+    int i, n = 0;
+
+    if (max > FLUSH_BATCH)
+        max = FLUSH_BATCH;
+
+    for (i = 0; i < NBUCKET && n < max; i++) {
+        struct bucket *bk = &bcache.bucket[i];
+        acquire(&bk->lock);
+        for (struct buf *b = bk->head; b && n < max; b = b->next) {
+            if (grab_dirty(b, before))
+                bps[n++] = b;
+        }
+        release(&bk->lock);
+    }
+    if (n > 0)
+        flush_locked(bps, n);
+    return n;
+}
+
+// write back every buffer that is dirty now, in use or not.
+void buf_sync(void) {
+    uint64 now = timer_get_ticks();
+
+    // the unused ones in batches
+    while (buf_flush(FLUSH_BATCH, now) > 0)
+        ;
+
+    // then the ones in use, one at a time
+    for (int i = 0; i < NBUCKET; i++) {
+        struct bucket *bk = &bcache.bucket[i];
+        struct buf *b;
+    again:
+        acquire(&bk->lock);
+        for (b = bk->head; b; b = b->next) {
+            if (b->dirty && b->dirtied <= now) {
+                flush_one(bk, b);
+                goto again;
+            }
+        }
+        release(&bk->lock);
+    }
+}
+
+// write back the dirty cached blocks among the n blocknos,
+// adjacent ones in one request.
+// the caller must hold no buffer.
+void buf_flushv(uint dev, uint *blocknos, int n) {
+    struct buf *bps[MAXBIO];
+    struct bucket *bk;
+    struct buf *b;
+    int i, k = 0;
+
+    if (n > MAXBIO)
+        panic("buf_flushv");
+
+    for (i = 0; i < n; i++) {
+        bk = hash(dev, blocknos[i]);
+        acquire(&bk->lock);
+        if ((b = bucket_find(bk, dev, blocknos[i])) != 0 && grab_dirty(b, (uint64)-1))
+            bps[k++] = b;
+        release(&bk->lock);
+    }
+    if (k > 0)
+        flush_locked(bps, k);
+
+    // the ones that were in use
+    for (i = 0; i < n; i++) {
+        bk = hash(dev, blocknos[i]);
+        acquire(&bk->lock);
+        if ((b = bucket_find(bk, dev, blocknos[i])) != 0 && b->dirty)
+            flush_one(bk, b);
+        else
+            release(&bk->lock);
+    }
+}
+
+// write the n buffers now, in block order, and wait.
+// for the log: the buffers are locked or pinned by the log,
+// and none of them is dirty.
+void buf_writeout(struct buf **bps, int n) {
+    sort_bufs(bps, n);
+    buf_rwv(bps, n, 1);
+}
+
+// the log holds b, which is locked, until its commit.
+// pinned, it stays cached; logged, neither the flusher nor
+// eviction writes it.
+void buf_pin(struct buf *b) {
+    struct bucket *bk = hash(b->dev, b->blockno);
+
+    if (!holdingsleep(&b->lock))
+        panic("buf_pin");
+    acquire(&bk->lock);
+    b->refcnt++;
+    b->logged = 1;
+    if (b->dirty) {
+        b->dirty = 0;
+        __sync_fetch_and_sub(&bcache.ndirty, 1);
+    }
+    release(&bk->lock);
+}
+
+// the commit has written b home.
+void buf_unpin(struct buf *b) {
+    struct bucket *bk = hash(b->dev, b->blockno);
+
+    acquire(&bk->lock);
+    b->logged = 0;
     b->refcnt--;
     if (b->refcnt == 0) {
-        b->next->prev = b->prev;
-        b->prev->next = b->next;
-        b->next = bcache.head.next;
-        b->prev = &bcache.head;
-        bcache.head.next->prev = b;
-        bcache.head.next = b;
+        b->lastuse = __sync_add_and_fetch(&bcache.clock, 1);
+        lru_add(bk, b);
+    }
+    release(&bk->lock);
+}
+
+// the flusher kernel thread.
+void buf_flusher(void) {
+    for (;;) {
+        timer_wait(FLUSH_TICKS);
+
+        uint64 now = timer_get_ticks();
+        uint64 before = now > DIRTY_TICKS ? now - DIRTY_TICKS : 0;
+
+        // too much dirty, write everything
+        while (bcache.ndirty > bcache.nbuf / DIRTY_FRAC) {
+            if (buf_flush(FLUSH_BATCH, now) == 0)
+                break;
+        }
+        while (bcache.ndirty > 0 && buf_flush(FLUSH_BATCH, before) > 0)
+            ;
+    }
+}
+
+// give up to npages data pages back to pmem, taking only pages
+// whose buffers are all free and never going below NBUF_MIN.
+// called by pmem_alloc when user memory runs out.
+// returns the number of pages freed.
+int buf_reclaim(int npages) {
+    void *freed[BUF_RECLAIM];
+    struct buf *b, **pp;
+    int g, i, n = 0;
+
+    // pmem_alloc called from buf_grow
+    if (holding(&bcache.lock))
+        return 0;
+    if (npages > BUF_RECLAIM)
+        npages = BUF_RECLAIM;
+
+    acquire(&bcache.lock);
+    for (i = 0; i < NBUCKET; i++)
+        acquire(&bcache.bucket[i].lock);
+
+    for (g = NGROUP - 1; g >= 0 && n < npages; g--) {
+        if (bcache.page[g] == 0 || bcache.nbuf - BPP < NBUF_MIN)
+            continue;
+        for (i = 0; i < BPP; i++) {
+            b = &bcache.buf[g * BPP + i];
+            if (b->refcnt != 0 || b->dirty)
+                break;
+        }
+        if (i < BPP)
+            continue;
+        for (i = 0; i < BPP; i++) {
+            b = &bcache.buf[g * BPP + i];
+            if (b->valid && b->ra)
+                bcache.bucket[0].ra_waste++;
+            b->data = 0;
+            b->valid = 0;
+            b->ra = 0;
+        }
+        freed[n++] = bcache.page[g];
+        bcache.page[g] = 0;
+        bcache.nbuf -= BPP;
+    }
+
+    // unlink the buffers that lost their data page
+    if (n > 0) {
+        for (i = 0; i < NBUCKET; i++) {
+            for (pp = &bcache.bucket[i].head; *pp; ) {
+                if ((*pp)->data == 0) {
+                    lru_remove(&bcache.bucket[i], *pp);
+                    *pp = (*pp)->next;
+                } else
+                    pp = &(*pp)->next;
+            }
+        }
+        bcache.shrinks += n;
     }
 
+    for (i = NBUCKET - 1; i >= 0; i--)
+        release(&bcache.bucket[i].lock);
     release(&bcache.lock);
+
+    for (i = 0; i < n; i++)
+        pmem_free(freed[i]);
+    return n;
+}
+
+// print size, hit, miss, eviction and readahead counts of the buffer cache.
+void buf_stat(void) {
+    uint64 hits = 0, misses = 0, evictions = 0, ra_hits = 0, ra_waste = 0;
+
+    for (int i = 0; i < NBUCKET; i++) {
+        struct bucket *bk = &bcache.bucket[i];
+        acquire(&bk->lock);
+        hits += bk->hits;
+        misses += bk->misses;
+        evictions += bk->evictions;
+        ra_hits += bk->ra_hits;
+        ra_waste += bk->ra_waste;
+        release(&bk->lock);
+    }
+    printf("bcache: %d buffers %d buckets, hits %ld misses %ld evictions %ld grows %ld shrinks %ld\n",
+           bcache.nbuf, NBUCKET, hits, misses, evictions, bcache.grows, bcache.shrinks);
+    printf("  readahead: issued %ld hits %ld wasted %ld\n", bcache.ra_issued, ra_hits, ra_waste);
+    printf("  write-back: dirty %d written %ld\n", bcache.ndirty, bcache.writebacks);
 }
 
 void buf_print(void) {
     printf("\nbuf_cache:\n");
-    struct buf *b = bcache.head.next;
-    acquire(&bcache.lock);
-    while(b != &bcache.head) {
-        printf("buf %d: ref = %d, block_num = %d\n", (int)(b - bcache.buf), b->refcnt, b->blockno);
-        for (int i = 0; i < 8; i++) {
-            printf("%d ", b->data[i]);
+    for (int i = 0; i < NBUCKET; i++) {
+        struct bucket *bk = &bcache.bucket[i];
+        acquire(&bk->lock);
+        for (struct buf *b = bk->head; b; b = b->next) {
+            printf("buf %d: ref = %d, block_num = %d\n", (int)(b - bcache.buf), b->refcnt, b->blockno);
+            for (int j = 0; j < 8; j++) {
+                printf("%d ", b->data[j]);
+            }
+            printf("\n");
         }
-        printf("\n");
-        b = b->next;
+        release(&bk->lock);
     }
-    release(&bcache.lock);
 }
@@ -0,0 +1,160 @@
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "lib/spinlock.h"
+#include "fs/fs.h"
+
+// Directory name cache
+//
+// maps (dev, directory inum, name) to the inum of the entry and its
+// offset in the directory, or to "no such name" (inum 0, a negative
+// entry), so dirlookup of a recent name does not read the directory.
+// dirlookup fills it, dirlink and unlink keep it up to date,
+// and dcache_purge drops the entries of a freed directory.
+// the callers hold the directory's inode lock, so an entry never
+// goes stale between the directory read and dcache_enter.
+
+#define NDENTRY 512
+#define NDHASH  127
+
+struct dentry {
+    uint dev;
+    uint dir;          // inum of the directory
+    uint inum;         // 0 if the name does not exist
+    uint off;          // offset of the dirent in the directory
+    char name[DIRSIZ];
+    struct dentry *hnext;
+    struct dentry *prev; // LRU list, most recently used first
+    struct dentry *next;
+};
+
+struct {
+    spinlock_t lock;
+    struct dentry *hash[NDHASH];
+    struct dentry lru;
+    struct dentry ent[NDENTRY];
+    uint64 hits;
+    uint64 neghits;
+    uint64 misses;
+    uint64 invals;
+} dcache;
+
+static uint dhash(uint dev, uint dir, char *name) {
+    uint h = dev * 31 + dir;
+
+    for (int i = 0; i < DIRSIZ && name[i]; i++)
+        h = h * 31 + (uchar)name[i];
+    return h % NDHASH;
+}
+
+static void lru_remove(struct dentry *d) {
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+}
+
+static void lru_insert(struct dentry *d, int tail) {
+    struct dentry *at = tail ? dcache.lru.prev : &dcache.lru;
+
+    d->next = at->next;
+    d->prev = at;
+    at->next->prev = d;
+    at->next = d;
+}
+
+static struct dentry* dfind(uint dev, uint dir, char *name) {
+    struct dentry *d;
+
+    for (d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext) {
+        if (d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+            return d;
+    }
+    return 0;
+}
+
+// unhash d and make it the next one reused
+static void dfree(struct dentry *d) {
+    struct dentry **pp;
+
+    for (pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+        ;
+    *pp = d->hnext;
+    d->dir = 0;
+    lru_remove(d);
+    lru_insert(d, 1);
+}
+
+void dcache_init(void) {
+    initlock(&dcache.lock, "dcache");
+    dcache.lru.prev = dcache.lru.next = &dcache.lru;
+    for (int i = 0; i < NDENTRY; i++)
+        lru_insert(&dcache.ent[i], 1);
+}
+
+// look up name in directory dir.
+// returns 1 and sets *inum (0 if there is no such name) and *off
+// if the answer is cached, 0 if not.
+int dcache_lookup(uint dev, uint dir, char *name, uint *inum, uint *off) {
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+    if ((d = dfind(dev, dir, name)) == 0) {
+        dcache.misses++;
+        release(&dcache.lock);
+        return 0;
+    }
+    if (d->inum)
+        dcache.hits++;
+    else
+        dcache.neghits++;
+    *inum = d->inum;
+    *off = d->off;
+    lru_remove(d);
+    lru_insert(d, 0);
+    release(&dcache.lock);
+    return 1;
+}
+
+// remember that name in dir is inum at off, or that there
+// is no such name if inum is 0.
+void dcache_enter(uint dev, uint dir, char *name, uint inum, uint off) {
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+    if ((d = dfind(dev, dir, name)) == 0) {
+        d = dcache.lru.prev;
+        if (d->dir)
+            dfree(d);
+        d->dev = dev;
+        d->dir = dir;
+        strncpy(d->name, name, DIRSIZ);
+        d->hnext = dcache.hash[dhash(dev, dir, name)];
+        dcache.hash[dhash(dev, dir, name)] = d;
+    }
+    d->inum = inum;
+    d->off = off;
+    lru_remove(d);
+    lru_insert(d, 0);
+    release(&dcache.lock);
+}
+
+// drop the entries of directory dir, which was freed,
+// so its inum can be reused.
+void dcache_purge(uint dev, uint dir) {
+    acquire(&dcache.lock);
+    for (int i = 0; i < NDENTRY; i++) {
+        struct dentry *d = &dcache.ent[i];
+        if (d->dir == dir && d->dev == dev) {
+            dfree(d);
+            dcache.invals++;
+        }
+    }
+    release(&dcache.lock);
+}
+
+void dcache_stat(void) {
+    acquire(&dcache.lock);
+    printf("dcache: %ld hits %ld negative hits %ld misses %ld purged\n",
+           dcache.hits, dcache.neghits, dcache.misses, dcache.invals);
+    release(&dcache.lock);
+}
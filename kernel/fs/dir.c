@@ -15,8 +15,233 @@ int namecmp(const char *s, const char *t) {
     return strncmp(s, t, DIRSIZ);
 }
 
+/*** hashed directories, see fs.h ***/
+
+// bucket splits per insert, bounds the blocks one create logs.
+// creating a directory in dp is the worst case, MAXOPBLOCKS
+// exactly with one split: the old and new bucket (2), block 0
+// with the table, also when it doubles (1), dp's indirect block
+// (1), the bitmap blocks of the two, two when they fall on both
+// sides of a group boundary (2), the inode blocks of dp and of
+// the new inode (2), and the new directory's first block and its
+// bitmap block, which is another group's (2).
+// a second split would add a bucket, past MAXOPBLOCKS; it is only
+// needed when every name of the split bucket lands on one side.
+#define MAXSPLIT 1
+
+static inline struct dirent* dslot(struct buf *bp, int i) {
+    return (struct dirent*)bp->data + i;
+}
+
+// entry i of the bucket table in block 0
+static uint dh_get(struct buf *b0, uint i) {
+    uint bn;
+
+    memmove(&bn, dslot(b0, DH_TABLE + i / DH_PERSLOT)->name + (i % DH_PERSLOT) * sizeof(uint), sizeof(uint));
+    return bn;
+}
+
+static void dh_set(struct buf *b0, uint i, uint bn) {
+    memmove(dslot(b0, DH_TABLE + i / DH_PERSLOT)->name + (i % DH_PERSLOT) * sizeof(uint), &bn, sizeof(uint));
+}
+
+// the bucket of name, after the table in b0
+static uint dh_bucket(struct buf *b0, char *name) {
+    uint depth = (uchar)dslot(b0, DH_HEAD)->name[0];
+
+    return dh_get(b0, dirhash(name) & ((1u << depth) - 1));
+}
+
+// read bucket bn of dp, as found in the table on disk, without
+// allocating. returns 0 if bn is not a block of dp.
+static struct buf* dh_read(struct inode *dp, uint bn) {
+    if (bn < 1 || bn >= dp->size / BSIZE)
+        return 0;
+    return ibread(dp, bn, 0);
+}
+
+// look up name in hashed directory dp: reads block 0 and one bucket.
+// returns 1 and sets *pinum and *poff if found, 0 if not or if
+// the table is bad.
+static int dh_find(struct inode *dp, char *name, uint *pinum, uint *poff) {
+    struct buf *bp;
+    uint bn;
+    int i;
+
+    if ((bp = ibread(dp, 0, 0)) == 0)
+        return 0;
+    // "." and ".." stay in block 0
+    for (i = 0; i < DH_HEAD; i++) {
+        if (dslot(bp, i)->inum && namecmp(name, dslot(bp, i)->name) == 0) {
+            *pinum = dslot(bp, i)->inum;
+            *poff = i * sizeof(struct dirent);
+            buf_release(bp);
+            return 1;
+        }
+    }
+    bn = dh_bucket(bp, name);
+    buf_release(bp);
+
+    if ((bp = dh_read(dp, bn)) == 0)
+        return 0;
+    for (i = 1; i < DPB; i++) {
+        if (dslot(bp, i)->inum && namecmp(name, dslot(bp, i)->name) == 0) {
+            *pinum = dslot(bp, i)->inum;
+            *poff = bn * BSIZE + i * sizeof(struct dirent);
+            buf_release(bp);
+            return 1;
+        }
+    }
+    buf_release(bp);
+    return 0;
+}
+
+// split the full bucket bp, block bn of dp, into itself and a new
+// block at the end of dp, doubling the table first if the bucket
+// is as deep as it. returns -1 if out of space.
+static int dh_split(struct inode *dp, struct buf *b0, struct buf *bp, uint bn) {
+    uint depth = (uchar)dslot(b0, DH_HEAD)->name[0];
+    uint ld = (uchar)dslot(bp, 0)->name[0];
+    uint nb, i, k;
+    struct buf *np;
+
+    if (ld == depth) {
+        if (depth == DH_MAXDEPTH)
+            return -1;
+        for (i = 0; i < (1u << depth); i++)
+            dh_set(b0, i + (1u << depth), dh_get(b0, i));
+        depth++;
+        dslot(b0, DH_HEAD)->name[0] = depth;
+        log_write(b0);
+    }
+
+    nb = dp->size / BSIZE;
+    if ((np = ibread(dp, nb, 1)) == 0)
+        return -1;
+    memset(np->data, 0, BSIZE);
+    dp->size += BSIZE;
+
+    // the names with bit ld of their hash set move to the new bucket
+    dslot(bp, 0)->name[0] = dslot(np, 0)->name[0] = ld + 1;
+    for (i = 1, k = 1; i < DPB; i++) {
+        struct dirent *de = dslot(bp, i);
+        if (de->inum && ((dirhash(de->name) >> ld) & 1)) {
+            *dslot(np, k++) = *de;
+            memset(de, 0, sizeof(*de));
+        }
+    }
+    for (i = 0; i < (1u << depth); i++) {
+        if (dh_get(b0, i) == bn && ((i >> ld) & 1))
+            dh_set(b0, i, nb);
+    }
+    log_write(b0);
+    log_write(bp);
+    log_write(np);
+    buf_release(np);
+    iupdate(dp);
+    // entries moved, forget their offsets
+    dcache_purge(dp->dev, dp->inum);
+    return 0;
+}
+
+// add (name, inum) to hashed directory dp.
+// returns the offset of the new entry, or -1.
+static int dh_insert(struct inode *dp, char *name, uint inum) {
+    struct buf *b0, *bp;
+    uint bn;
+    int i, split;
+
+    for (split = 0; ; split++) {
+        if ((b0 = ibread(dp, 0, 0)) == 0)
+            return -1;
+        bn = dh_bucket(b0, name);
+        if ((bp = dh_read(dp, bn)) == 0) {
+            buf_release(b0);
+            return -1;
+        }
+        for (i = 1; i < DPB; i++) {
+            if (dslot(bp, i)->inum == 0) {
+                strncpy(dslot(bp, i)->name, name, DIRSIZ);
+                dslot(bp, i)->inum = inum;
+                log_write(bp);
+                buf_release(bp);
+                buf_release(b0);
+                return bn * BSIZE + i * sizeof(struct dirent);
+            }
+        }
+        if (split == MAXSPLIT || dh_split(dp, b0, bp, bn) < 0) {
+            buf_release(bp);
+            buf_release(b0);
+            return -1;
+        }
+        buf_release(bp);
+        buf_release(b0);
+    }
+}
+
+// turn dp, a linear directory with one full block, into a hashed
+// directory with two buckets.
+// returns -1 if out of space.
+static int dh_convert(struct inode *dp) {
+    struct dirent *old;
+    struct buf *b0, *b[2];
+    uint k[2] = {1, 1};
+    int i, j;
+
+    if ((old = pmem_alloc(0)) == 0)
+        return -1;
+    if (readi(dp, 0, (uint64)old, 0, BSIZE) != BSIZE)
+        panic("dh_convert read");
+
+    if ((b0 = ibread(dp, 0, 0)) == 0) {
+        pmem_free(old);
+        return -1;
+    }
+    if ((b[0] = ibread(dp, 1, 1)) == 0) {
+        buf_release(b0);
+        pmem_free(old);
+        return -1;
+    }
+    if ((b[1] = ibread(dp, 2, 1)) == 0) {
+        buf_release(b[0]);
+        buf_release(b0);
+        pmem_free(old);
+        return -1;
+    }
+
+    memset(b0->data, 0, BSIZE);
+    *dslot(b0, 0) = old[0];  // "."
+    *dslot(b0, 1) = old[1];  // ".."
+    dslot(b0, DH_HEAD)->name[0] = 1;
+    for (j = 0; j < 2; j++) {
+        memset(b[j]->data, 0, BSIZE);
+        dslot(b[j], 0)->name[0] = 1;
+        dh_set(b0, j, j + 1);
+    }
+    for (i = DH_HEAD; i < DPB; i++) {
+        if (old[i].inum) {
+            j = dirhash(old[i].name) & 1;
+            *dslot(b[j], k[j]++) = old[i];
+        }
+    }
+    log_write(b0);
+    for (j = 0; j < 2; j++) {
+        log_write(b[j]);
+        buf_release(b[j]);
+    }
+    buf_release(b0);
+    pmem_free(old);
+
+    dp->size = 3 * BSIZE;
+    dp->major = DIR_HASHED;
+    iupdate(dp);
+    dcache_purge(dp->dev, dp->inum);
+    return 0;
+}
+
 // look for a directory entry in a directiry
 // if found, set *poff to byte offset of entry
+// the dcache answers for recently looked up names, found or not.
 struct inode* dirlookup(struct inode *dp, char *name, uint *poff) {
     uint off, inum;
     struct dirent de;
@@ -24,6 +249,25 @@ struct inode* dirlookup(struct inode *dp, char *name, uint *poff) {
     if (dp->type != T_DIR)
         panic("dirlookup not DIR");
 
+    if (dcache_lookup(dp->dev, dp->inum, name, &inum, &off)) {
+        if (inum == 0)
+            return 0;
+        if (poff)
+            *poff = off;
+        return iget(dp->dev, inum);
+    }
+
+    if (dp->major == DIR_HASHED) {
+        if (dh_find(dp, name, &inum, &off)) {
+            if (poff)
+                *poff = off;
+            dcache_enter(dp->dev, dp->inum, name, inum, off);
+            return iget(dp->dev, inum);
+        }
+        dcache_enter(dp->dev, dp->inum, name, 0, 0);
+        return 0;
+    }
+
     for (off = 0; off < dp->size; off += sizeof(de)) {
         if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
             panic("dirlookup read");
@@ -33,14 +277,17 @@ struct inode* dirlookup(struct inode *dp, char *name, uint *poff) {
             if (poff)
                 *poff = off;
             inum = de.inum;
+            dcache_enter(dp->dev, dp->inum, name, inum, off);
             return iget(dp->dev, inum);
         } 
     }
 
+    dcache_enter(dp->dev, dp->inum, name, 0, 0);
     return 0;
 }
 
 // write a new directory entry (name, inum) into the directory dp.
+// a directory that outgrows its first block becomes hashed.
 // returns 0 on success, -1 on failure
 int dirlink(struct inode *dp, char *name, uint inum) {
     int off;
@@ -52,17 +299,29 @@ int dirlink(struct inode *dp, char *name, uint inum) {
         return -1;
     }
 
-    for (off = 0; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-            panic("dirlink read");
-        if (de.inum == 0)
-            break;
+    if (dp->major != DIR_HASHED) {
+        for (off = 0; off < dp->size; off += sizeof(de)) {
+            if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+                panic("dirlink read");
+            if (de.inum == 0)
+                break;
+        }
+        if (off == BSIZE && dp->size == BSIZE && dh_convert(dp) < 0)
+            return -1;
+    }
+
+    if (dp->major == DIR_HASHED) {
+        if ((off = dh_insert(dp, name, inum)) < 0)
+            return -1;
+        dcache_enter(dp->dev, dp->inum, name, inum, off);
+        return 0;
     }
 
     strncpy(de.name, name, DIRSIZ);
     de.inum = inum;
     if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
         return -1;
+    dcache_enter(dp->dev, dp->inum, name, inum, off);
 
     return 0;
 }
@@ -27,6 +27,7 @@ struct file* filealloc(void) {
     for(f = ftable.file; f < ftable.file + NFILE; f++) {
         if (f->ref == 0) {
             f->ref = 1;
+            memset(&f->ra, 0, sizeof(f->ra));
             release(&ftable.lock);
             return f;
         }
@@ -64,7 +65,9 @@ void fileclose(struct file *f) {
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+        begin_op();
         iput(ff.ip);
+        end_op();
     }
 }
 
@@ -100,8 +103,10 @@ int fileread(struct file *f, uint64 addr, int n) {
         r = devsw[f->major].read(1, addr, n);
     } else if(f->type == FD_INODE){
         ilock(f->ip);
-        if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-        f->off += r;
+        if((r = readi(f->ip, 1, addr, f->off, n)) > 0) {
+            ireadahead(f->ip, &f->ra, f->off, r);
+            f->off += r;
+        }
         iunlock(f->ip);
     } else {
         panic("fileread");
@@ -134,10 +139,12 @@ int filewrite(struct file *f, uint64 addr, int n) {
       if(n1 > max)
         n1 = max;
 
+      begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
+      end_op();
 
       if(r != n1){
         // error from writei
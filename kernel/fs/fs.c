@@ -26,6 +26,9 @@ void fsinit(int dev) {
     readsb(dev, &sb);
     if(sb.magic != FSMAGIC)
         panic("invalid file system");
-    //initlog(dev, &sb);
+    if (sb.groupsize == 0)  // no groups, one group
+        sb.groupsize = sb.size;
+    initlog(dev, &sb);
+    balloc_init(dev);
     ireclaim(dev);
 }
@@ -13,42 +13,155 @@
 
 extern struct superblock sb;
 
+// the inode cache: a hash table of (dev, inum), and the unused
+// inodes (ref == 0) on an LRU list, most recently used first.
+// an unused inode keeps its contents until iget takes it for
+// another inum, so ilock of a recently used inode does not read
+// the disk. inodes that never held one are at the end.
+// the cache is 1/INODE_FRAC of the kernel memory, set at boot,
+// but no more than the NINODES inodes a file system has.
+// the hash has a power of two buckets, about two inodes each.
+#define INODE_FRAC 64
+#define NIHASH     (NINODES / 2)
+
 struct {
     spinlock_t lock;
-    struct inode inode[NINODE];
+    struct inode *hash[NIHASH];
+    uint nhash;        // buckets in use, a power of two
+    struct inode lru;  // head of the LRU list
+    int ninode;
+    uint64 hits;
+    uint64 misses;
+    uint64 evictions;
 } itable;
 
+static inline struct inode** ihash(uint dev, uint inum) {
+    return &itable.hash[(dev * 31 + inum) & (itable.nhash - 1)];
+}
+
+static void lru_remove(struct inode *ip) {
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+}
+
+// put ip at the front of the LRU list, or at the end if tail
+static void lru_insert(struct inode *ip, int tail) {
+    struct inode *at = tail ? itable.lru.prev : &itable.lru;
+
+    ip->next = at->next;
+    ip->prev = at;
+    at->next->prev = ip;
+    at->next = ip;
+}
+
 void iinit() {
-    int i = 0;
+    int i, n, npage;
+    struct inode *ip;
 
     initlock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
+    itable.lru.prev = itable.lru.next = &itable.lru;
+
+    n = PGSIZE / sizeof(struct inode);
+    npage = pmem_nfree(0) / INODE_FRAC;
+    if (npage * n < NINODE_MIN)
+        npage = (NINODE_MIN + n - 1) / n;
+    if (npage * n > NINODES)
+        npage = NINODES / n;
+    for (i = 0; i < npage; i++) {
+        if ((ip = pmem_alloc(0)) == 0)
+            panic("iinit");
+        for (int j = 0; j < n; j++, ip++) {
+            memset(ip, 0, sizeof(*ip));
+            initsleeplock(&ip->lock, "inode");
+            lru_insert(ip, 1);
+        }
+    }
+    itable.ninode = npage * n;
+    for (itable.nhash = 1; itable.nhash * 2 < itable.ninode && itable.nhash < NIHASH; )
+        itable.nhash *= 2;
+}
+
+// in-memory map of the inodes in use, one bit per inode, built
+// by ireclaim at mount, so ialloc reads only the inode it takes.
+// hint[g] is the lowest inum of group g that may be free.
+static struct {
+    spinlock_t lock;
+    uint64 *map;
+    uint hint[MAXGROUPS];
+} imap;
+
+// the first free inum at or after inum, or -1.
+static int imap_next(uint inum) {
+    uint64 x;
+    uint w;
+
+    for (w = inum / 64; w * 64 < sb.ninodes; w++) {
+        x = ~imap.map[w];
+        if (w == inum / 64)
+            x &= ~0UL << (inum % 64);
+        if (x) {
+            inum = w * 64 + ctz64(x);
+            return inum < sb.ninodes ? inum : -1;
+        }
+    }
+    return -1;
+}
+
+static void imap_set(uint inum, int used) {
+    uint g = IGROUP(inum, sb);
+
+    if (used) {
+        imap.map[inum / 64] |= 1UL << (inum % 64);
+    } else {
+        imap.map[inum / 64] &= ~(1UL << (inum % 64));
+        if (inum < imap.hint[g])
+            imap.hint[g] = inum;
     }
 }
 
 // allocate an inode
+// a directory goes to a new allocation group, any other
+// inode to the group of parent, its directory.
 // returns an unlocked but allocated and referenced inode
 // or NULL if there is no free inode
-struct inode* ialloc(uint dev, short type) {
+struct inode* ialloc(uint dev, short type, uint parent) {
+    uint g, start;
     int inum;
     struct buf *bp;
     struct dinode *dip;
 
-    for (inum = 1; inum < sb.ninodes; inum++) {
-        bp = buf_read(dev, IBLOCK(inum, sb));
-        dip = (struct dinode*)bp->data + inum%IPB;
-        if (dip->type == 0) {
-            memset(dip, 0, sizeof(*dip));
-            dip->type = type;
-            buf_write(bp);
-            buf_release(bp);
-            return iget(dev, inum);
-        }
-        buf_release(bp);
+    if (type == T_DIR)
+        g = balloc_dirgroup();
+    else
+        g = IGROUP(parent, sb);
+    start = g * IPG(sb);
+
+    acquire(&imap.lock);
+    if (imap.hint[g] > start)
+        start = imap.hint[g];
+    if ((inum = imap_next(start)) < 0)
+        inum = imap_next(1);
+    if (inum >= 0) {
+        imap_set(inum, 1);
+        // group g is full up to inum, or full if inum is elsewhere
+        imap.hint[g] = IGROUP(inum, sb) == g ? inum + 1 : (g + 1) * IPG(sb);
     }
-    printf("ialloc: no inodes\n");
-    return 0;
+    release(&imap.lock);
+
+    if (inum < 0) {
+        printf("ialloc: no inodes\n");
+        return 0;
+    }
+
+    bp = buf_read(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if (dip->type != 0)
+        panic("ialloc: inode in use");
+    memset(dip, 0, sizeof(*dip));
+    dip->type = type;
+    log_write(bp);
+    buf_release(bp);
+    return iget(dev, inum);
 }
 
 // update a modified inode to disk
@@ -64,7 +177,7 @@ void iupdate(struct inode *ip) {
     dip->nlink = ip->nlink;
     dip->size = ip->size;
     memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-    buf_write(bp);
+    log_write(bp);
     buf_release(bp);
 }
 
@@ -72,30 +185,42 @@ void iupdate(struct inode *ip) {
 // return the in-memory copy.
 // doesn't lock the inode and doesn't read it from disk
 struct inode* iget(uint dev, uint inum) {
-    struct inode *ip, *empty;
+    struct inode *ip, **pp;
+
     acquire(&itable.lock);
 
-    empty = 0;
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
+    for (ip = *ihash(dev, inum); ip; ip = ip->hnext) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref++ == 0)
+                lru_remove(ip);
+            itable.hits++;
             release(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0) {
-            empty = ip;
-        }
     }
+    itable.misses++;
 
-    if (empty == 0) {
+    // recycle the least recently used unused inode
+    ip = itable.lru.prev;
+    if (ip == &itable.lru) {
         panic("iget: no inodes");
     }
+    lru_remove(ip);
+    if (ip->inum != 0) {
+        for (pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+            ;
+        *pp = ip->hnext;
+        if (ip->valid)
+            itable.evictions++;
+    }
 
-    ip = empty;
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
     ip->valid = 0;
+    pp = ihash(dev, inum);
+    ip->hnext = *pp;
+    *pp = ip;
     release(&itable.lock);
 
     return ip;
@@ -161,17 +286,25 @@ void iput(struct inode *ip) {
         
         release(&itable.lock);
         
+        if (ip->type == T_DIR)
+            dcache_purge(ip->dev, ip->inum);
         itrunc(ip);
         ip->type = 0;
         iupdate(ip);
         ip->valid = 0;
 
+        acquire(&imap.lock);
+        imap_set(ip->inum, 0);
+        release(&imap.lock);
+
         releasesleep(&ip->lock);
 
         acquire(&itable.lock);
     }
 
-    ip->ref--;
+    // an unused inode stays cached, a freed one is reused first
+    if (--ip->ref == 0)
+        lru_insert(ip, !ip->valid);
     release(&itable.lock);
 }
 
@@ -181,20 +314,34 @@ void iunlockput(struct inode *ip) {
     iput(ip);
 }
 
+// read the inode table at mount: build imap and free the
+// orphaned inodes, allocated but not linked anywhere.
 void ireclaim(int dev) {
+    initlock(&imap.lock, "imap");
+    if (sb.ninodes > PGSIZE * 8 || (imap.map = pmem_alloc(0)) == 0)
+        panic("ireclaim: imap");
+    memset(imap.map, 0, PGSIZE);
+    imap_set(0, 1);
+    for (int g = 0; g < NGROUPS(sb); g++)
+        imap.hint[g] = g * IPG(sb);
+
     for (int inum = 1; inum < sb.ninodes; inum++) {
         struct inode *ip = 0;
         struct buf *bp = buf_read(dev, IBLOCK(inum, sb));
         struct dinode *dip = (struct dinode *)bp->data + inum % IPB;
+        if (dip->type != 0)
+            imap_set(inum, 1);
         if (dip->type != 0 && dip->nlink == 0) {  // is an orphaned inode
             printf("ireclaim: orphaned inode %d\n", inum);
             ip = iget(dev, inum);
         }
         buf_release(bp);
         if (ip) {
+            begin_op();
             ilock(ip);
             iunlock(ip);
             iput(ip);
+            end_op();
         }
     }
 }
@@ -203,73 +350,233 @@ void ireclaim(int dev) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[INDIRECT], and the NDINDIRECT
+// after them in the blocks listed in block ip->addrs[DINDIRECT].
+// With FS_EXTENT the direct slots hold extents instead.
+
+// where new blocks of ip go when there is no previous block
+// to follow: after its last direct block or extent, or at the
+// start of the allocation group of its inode.
+static uint igoal(struct inode *ip) {
+    struct extent *e = (struct extent*)ip->addrs;
+    int i;
+
+    if (sb.flags & FS_EXTENT) {
+        for (i = NEXTENT - 1; i >= 0; i--) {
+            if (e[i].len)
+                return e[i].start + e[i].len;
+        }
+    } else {
+        for (i = NDIRECT - 1; i >= 0; i--) {
+            if (ip->addrs[i])
+                return ip->addrs[i] + 1;
+        }
+    }
+    return IGROUP(ip->inum, sb) * sb.groupsize;
+}
 
-// return the disk block address of the nth block in inode ip
-// if there is no such block, bmap allocates one
+// return block bn of the tree of depth levels under *root,
+// allocating the missing blocks near goal, each one after its
+// left sibling or its index block. depth 0 is a data block,
+// 1 an indirect block, 2 a double-indirect block.
 // returns 0 if out of disk space
-static uint bmap(struct inode *ip, uint bn) {
-    uint addr, *a;
+static uint bmap_tree(struct inode *ip, uint *root, uint bn, int depth, uint goal) {
+    uint addr, idx, *a;
     struct buf *bp;
 
-    if (bn < NDIRECT) {
-        if ((addr = ip->addrs[bn]) == 0) {
-            addr = balloc(ip->dev);
-            if (addr == 0)
-                return 0;
-            ip->addrs[bn] = addr;
-        }
-        return addr;
+    if ((addr = *root) == 0) {
+        addr = balloc(ip->dev, goal);
+        if (addr == 0)
+            return 0;
+        *root = addr;
     }
-    bn -= NDIRECT;
-
-    if (bn < NINDIRECT) {
-        // load indirect block, allocating if necessary
-        if ((addr = ip->addrs[NDIRECT]) == 0) {
-            addr = balloc(ip->dev);
-            if (addr == 0)
-                return 0;
-            ip->addrs[NDIRECT] = addr;
-        }
+    while (depth-- > 0) {
+        idx = (depth ? bn / NINDIRECT : bn) % NINDIRECT;
         bp = buf_read(ip->dev, addr);
         a = (uint*)bp->data;
-        if((addr = a[bn]) == 0) {
-            addr = balloc(ip->dev);
+        if ((addr = a[idx]) == 0) {
+            goal = idx > 0 && a[idx-1] ? a[idx-1] + 1 : bp->blockno + 1;
+            addr = balloc(ip->dev, goal);
             if (addr) {
-                a[bn] = addr;
-                buf_write(bp);
+                a[idx] = addr;
+                log_write(bp);
             }
         }
         buf_release(bp);
-        return addr;
+        if (addr == 0)
+            return 0;
+    }
+    return addr;
+}
+
+// map block bn through the extents. new blocks extend the last
+// extent if the blocks after it are free, else start a new extent
+// with a free run of up to want blocks, the blocks bn.. that the
+// caller is about to map.
+// once the extents are full the rest of the file goes in the tree,
+// and the extents never change again, so tree indexes stay put.
+// returns 0 if out of disk space, or *tree the index of bn
+// in the tree.
+static uint bmap_extent(struct inode *ip, uint bn, uint want, uint *tree) {
+    struct extent *e = (struct extent*)ip->addrs;
+    uint first = 0, addr, got;
+    int i;
+
+    for (i = 0; i < NEXTENT && e[i].len; i++) {
+        if (bn < first + e[i].len)
+            return e[i].start + bn - first;
+        first += e[i].len;
+    }
+
+    if (bn == first && ip->addrs[INDIRECT] == 0) {
+        if (i > 0) {
+            addr = e[i-1].start + e[i-1].len;
+            if ((got = balloc_at(ip->dev, addr, want)) > 0) {
+                e[i-1].len += got;
+                return addr;
+            }
+        }
+        if (i < NEXTENT) {
+            if ((addr = ballocn(ip->dev, igoal(ip), want, &got)) == 0)
+                return 0;
+            e[i].start = addr;
+            e[i].len = got;
+            return addr;
+        }
+    }
+    *tree = bn - first;
+    return 0;
+}
+
+// return the disk block address of the nth block in inode ip
+// if there is no such block, bmap allocates one, or with extents
+// up to want adjacent ones for the blocks after it.
+// returns 0 if out of disk space
+static uint bmap(struct inode *ip, uint bn, uint want) {
+    uint addr;
+
+    if (sb.flags & FS_EXTENT) {
+        uint tree = (uint)-1;
+        if ((addr = bmap_extent(ip, bn, want, &tree)) != 0 || tree == (uint)-1)
+            return addr;
+        bn = tree;
+    } else {
+        if (bn < NDIRECT) {
+            uint goal = bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : igoal(ip);
+            return bmap_tree(ip, &ip->addrs[bn], 0, 0, goal);
+        }
+        bn -= NDIRECT;
     }
 
-    panic("bmap: out of range");
+    if (bn < NINDIRECT)
+        return bmap_tree(ip, &ip->addrs[INDIRECT], bn, 1, igoal(ip));
+    bn -= NINDIRECT;
+
+    if (bn < NDINDIRECT)
+        return bmap_tree(ip, &ip->addrs[DINDIRECT], bn, 2, igoal(ip));
+
+    // extents left fewer blocks to the tree than MAXFILE
+    return 0;
 }
 
-// truncate inode (discard contents)
-void itrunc(struct inode *ip) {
-    int i, j;
+// the disk block address of the nth block in inode ip, like
+// bmap, but never allocates: returns 0 if the block is not mapped.
+static uint bmap_lookup(struct inode *ip, uint bn) {
+    struct extent *e = (struct extent*)ip->addrs;
+    uint first = 0, addr, idx;
     struct buf *bp;
-    uint *a;
+    int i, depth;
 
-    for(i = 0; i < NDIRECT; i++) {
-        if(ip->addrs[i]) {
-            bfree(ip->dev, ip->addrs[i]);
-            ip->addrs[i] = 0;
+    if (sb.flags & FS_EXTENT) {
+        for (i = 0; i < NEXTENT && e[i].len; i++) {
+            if (bn < first + e[i].len)
+                return e[i].start + bn - first;
+            first += e[i].len;
         }
+        bn -= first;
+    } else {
+        if (bn < NDIRECT)
+            return ip->addrs[bn];
+        bn -= NDIRECT;
+    }
+
+    if (bn < NINDIRECT) {
+        addr = ip->addrs[INDIRECT];
+        depth = 1;
+    } else if (bn - NINDIRECT < NDINDIRECT) {
+        bn -= NINDIRECT;
+        addr = ip->addrs[DINDIRECT];
+        depth = 2;
+    } else {
+        return 0;
+    }
+    while (addr && depth-- > 0) {
+        idx = (depth ? bn / NINDIRECT : bn) % NINDIRECT;
+        bp = buf_read(ip->dev, addr);
+        addr = ((uint*)bp->data)[idx];
+        buf_release(bp);
     }
+    return addr;
+}
+
+// return a locked buffer with block bn of ip, or 0.
+// if alloc, a missing block is allocated, which must be done
+// inside a transaction, and 0 means out of disk space; the caller
+// logs its changes and sets ip->size.
+// if not, 0 means bn is not mapped.
+struct buf* ibread(struct inode *ip, uint bn, int alloc) {
+    uint addr;
+
+    if ((addr = alloc ? bmap(ip, bn, 1) : bmap_lookup(ip, bn)) == 0)
+        return 0;
+    return buf_read(ip->dev, addr);
+}
+
+// free the tree of depth levels under addr.
+static void itrunc_tree(struct inode *ip, uint addr, int depth) {
+    struct buf *bp;
+    uint *a;
+    int j;
 
-    if (ip->addrs[NDIRECT]) {
-        bp = buf_read(ip->dev, ip->addrs[NDIRECT]);
+    if (depth > 0) {
+        bp = buf_read(ip->dev, addr);
         a = (uint*)bp->data;
-        for(j = 0; j < NINDIRECT; j++){
-            if(a[j])
-                bfree(ip->dev, a[j]);
+        for (j = 0; j < NINDIRECT; j++) {
+            if (a[j])
+                itrunc_tree(ip, a[j], depth - 1);
         }
         buf_release(bp);
-        bfree(ip->dev, ip->addrs[NDIRECT]);
-        ip->addrs[NDIRECT] = 0;       
+    }
+    bfree(ip->dev, addr);
+}
+
+// truncate inode (discard contents)
+void itrunc(struct inode *ip) {
+    int i;
+
+    if (sb.flags & FS_EXTENT) {
+        struct extent *e = (struct extent*)ip->addrs;
+        for (i = 0; i < NEXTENT; i++) {
+            if (e[i].len)
+                bfreen(ip->dev, e[i].start, e[i].len);
+            e[i].start = e[i].len = 0;
+        }
+    } else {
+        for (i = 0; i < NDIRECT; i++) {
+            if (ip->addrs[i]) {
+                bfree(ip->dev, ip->addrs[i]);
+                ip->addrs[i] = 0;
+            }
+        }
+    }
+
+    if (ip->addrs[INDIRECT]) {
+        itrunc_tree(ip, ip->addrs[INDIRECT], 1);
+        ip->addrs[INDIRECT] = 0;
+    }
+    if (ip->addrs[DINDIRECT]) {
+        itrunc_tree(ip, ip->addrs[DINDIRECT], 2);
+        ip->addrs[DINDIRECT] = 0;
     }
 
     ip->size = 0;
@@ -286,59 +593,160 @@ void stati(struct inode *ip, struct stat *st) {
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// map up to MAXBIO blocks of ip starting at byte off,
+// enough to cover n bytes, into addrs.
+// returns the number of blocks mapped.
+static int bmapv(struct inode *ip, uint off, uint n, uint *addrs) {
+    uint bn = off / BSIZE;
+    uint last = (off + n - 1) / BSIZE;
+    int k;
+
+    for (k = 0; k < MAXBIO && bn + k <= last; k++) {
+        if ((addrs[k] = bmap(ip, bn + k, min(last - (bn + k) + 1, MAXBIO - k))) == 0)
+            break;
+    }
+    return k;
+}
+
 // read data from inode
 // if user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address
+// blocks are read MAXBIO at a time, so the ones adjacent
+// on disk go to the device as one request.
 int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
-    uint tot, m;
-    struct buf *bp;
+    uint tot, m, addrs[MAXBIO];
+    struct buf *bps[MAXBIO];
+    int i, k;
 
     if (off > ip->size || off +n < off)
         return 0;
     if (off + n > ip->size)
         n = ip->size - off;
 
-    for (tot = 0; tot < n; tot += m, off += m, dst += m) {
-        uint addr = bmap(ip, off/BSIZE);
-        if(addr == 0)
+    for (tot = 0; tot < n; ) {
+        if ((k = bmapv(ip, off, n - tot, addrs)) == 0)
             break;
-        bp = buf_read(ip->dev, addr);
-        m = min(n - tot, BSIZE - off%BSIZE);
-        if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-            buf_release(bp);
+        buf_readv(ip->dev, addrs, k, bps);
+        for (i = 0; i < k; i++, tot += m, off += m, dst += m) {
+            m = min(n - tot, BSIZE - off%BSIZE);
+            if (either_copyout(user_dst, dst, bps[i]->data + (off % BSIZE), m) == -1)
+                break;
+        }
+        for (int j = 0; j < k; j++)
+            buf_release(bps[j]);
+        if (i < k) {
             tot = -1;
             break;
         }
-        buf_release(bp);
     }
     return tot;
 }
 
+// after a read of n bytes at off, prefetch the blocks that
+// follow if the reads through ra look sequential.
+// the window starts at RA_MIN blocks and doubles on every
+// sequential read up to RA_MAX. a read anywhere else
+// turns readahead off until the reads are sequential again.
+// caller must hold ip->lock.
+void ireadahead(struct inode *ip, struct readahead *ra, uint off, uint n) {
+    uint first, last, start, stop, nblocks, addrs[MAXBIO];
+    int k;
+
+    if (n == 0)
+        return;
+    first = off / BSIZE;
+    last = (off + n - 1) / BSIZE;
+
+    // the block read last time may be read again for its tail
+    if (first != ra->next && first + 1 != ra->next) {
+        ra->next = last + 1;
+        ra->win = 0;
+        ra->end = 0;
+        return;
+    }
+    ra->next = last + 1;
+    if (ra->win == 0)
+        ra->win = RA_MIN;
+    else if (ra->win < RA_MAX)
+        ra->win *= 2;
+
+    nblocks = (ip->size + BSIZE - 1) / BSIZE;
+    stop = min(ra->next + ra->win, nblocks);
+    start = ra->end > ra->next ? ra->end : ra->next;
+
+    // top up the window in batches, not a block per read
+    if (start >= stop || stop - start < ra->win / 2)
+        return;
+
+    while (start < stop) {
+        for (k = 0; k < MAXBIO && start + k < stop; k++) {
+            if ((addrs[k] = bmap(ip, start + k, 1)) == 0)
+                break;
+        }
+        if (k == 0)
+            break;
+        buf_prefetch(ip->dev, addrs, k);
+        start += k;
+    }
+    ra->end = start;
+}
+
+// write back the dirty cached data blocks of ip.
+// its inode, indirect and bitmap blocks are metadata, which the
+// log commits at the end of every FS system call.
+// caller must hold ip->lock.
+void ifsync(struct inode *ip) {
+    uint bn, nblocks, addrs[MAXBIO];
+    int k;
+
+    nblocks = (ip->size + BSIZE - 1) / BSIZE;
+    for (bn = 0; bn < nblocks; bn += k) {
+        for (k = 0; k < MAXBIO && bn + k < nblocks; k++) {
+            if ((addrs[k] = bmap(ip, bn + k, 1)) == 0)
+                break;
+        }
+        if (k == 0)
+            break;
+        buf_flushv(ip->dev, addrs, k);
+    }
+}
+
 // write data to inode
 // if user_src==1, then src is a user virtual addr; otherwise kernel addr
 // returns the number of bytes successfully written.
 // if return value is less than requested n, there was an error of some kind
 int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
-    uint tot, m;
-    struct buf *bp;
+    uint tot, m, addrs[MAXBIO];
+    struct buf *bps[MAXBIO];
+    int i, k;
 
     if (off > ip->size || off + n < off)
         return -1;
     if (off + n > MAXFILE*BSIZE)
         return -1;
 
-    for (tot = 0; tot < n; tot += m, off += m, src += m) {
-        uint addr = bmap(ip, off/BSIZE);
-        if (addr == 0)
-            break;
-        bp = buf_read(ip->dev, addr);
-        m = min(n - tot, BSIZE - off%BSIZE);
-        if (either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-            buf_release(bp);
+    for (tot = 0; tot < n; ) {
+        if ((k = bmapv(ip, off, n - tot, addrs)) == 0)
             break;
+        buf_readv(ip->dev, addrs, k, bps);
+        for (i = 0; i < k; i++, tot += m, off += m, src += m) {
+            m = min(n - tot, BSIZE - off%BSIZE);
+            if (either_copyin(bps[i]->data + (off % BSIZE), user_src, src, m) == -1)
+                break;
         }
-        buf_write(bp);
-        buf_release(bp);
+        // directories are metadata and go through the log,
+        // file data is written back later
+        if (ip->type == T_DIR) {
+            for (int j = 0; j < i; j++)
+                log_write(bps[j]);
+        } else if (i > 0) {
+            buf_writev(bps, i);
+        }
+        for (int j = 0; j < k; j++)
+            buf_release(bps[j]);
+        if (i < k)
+            break;
     }
 
     if (off > ip->size)
@@ -349,6 +757,13 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
     return tot;
 }
 
+void istat(void) {
+    acquire(&itable.lock);
+    printf("inode cache: %d inodes, %ld hits %ld misses %ld evictions\n",
+           itable.ninode, itable.hits, itable.misses, itable.evictions);
+    release(&itable.lock);
+}
+
 static char* inode_types[] = {
     "INODE_UNUSED",
     "INODE_DIR",
@@ -366,7 +781,7 @@ void printi(struct inode *ip) {
     printf("num = %d, ref = %d, valid = %d\n", ip->inum, ip->ref, ip->valid);
     printf("type = %s, major = %d, minor = %d, nlink = %d\n", inode_types[ip->type], ip->major, ip->minor, ip->nlink);
     printf("size = %d, addrs =", ip->size);
-    for (int i = 0; i < NDIRECT + 1; i++) {
+    for (int i = 0; i < NADDRS; i++) {
         printf(" %d", ip->addrs[i]);
     }
     printf("\n");
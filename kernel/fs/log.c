@@ -0,0 +1,269 @@
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "lib/spinlock.h"
+#include "lib/sleeplock.h"
+#include "fs/fs.h"
+#include "fs/buf.h"
+
+// Simple logging that allows concurrent FS system calls.
+//
+// A log transaction contains the updates of multiple FS system
+// calls. The logging system only commits when there are
+// no FS system calls active. Thus there is never
+// any reasoning required about whether a commit might
+// write an uncommitted system call's updates to disk.
+//
+// A system call should call begin_op()/end_op() to mark
+// its start and end. Usually begin_op() just increments
+// the count of in-progress FS system calls and returns.
+// But if it thinks the log is close to running out, it
+// sleeps until the last outstanding end_op() commits.
+//
+// The log holds the metadata blocks: inodes, the free bitmap,
+// indirect and directory blocks, and newly zeroed blocks.
+// Overwrites of file data go through the write-back cache
+// (buf_write) and are not journaled.
+//
+// A block written several times in one transaction takes one
+// log slot and is written once (absorption).
+// The commit writes the log, the header and then the home
+// locations with a few multi-block disk requests.
+//
+// The log is a physical re-do log containing disk blocks.
+// The on-disk log format:
+//   header block, containing block #s for block A, B, C, ...
+//   block A
+//   block B
+//   block C
+//   ...
+// Log appends are synchronous.
+
+// Contents of the header block, used for both the on-disk header block
+// and to keep track in memory of logged block# before commit.
+struct logheader {
+    int n;
+    int block[LOGBLOCKS];
+};
+
+struct log {
+    spinlock_t lock;
+    int start;
+    int outstanding; // how many FS sys calls are executing.
+    int committing;  // in commit(), please wait.
+    int dev;
+    struct logheader lh;
+    struct buf *buf[LOGBLOCKS]; // pinned cache buffers of lh.block
+
+    // statistics, protected by lock
+    uint64 commits;
+    uint64 ops;
+    uint64 logged;
+    uint64 absorbed;
+};
+struct log log;
+
+static void recover_from_log(void);
+static void commit();
+
+void initlog(int dev, struct superblock *sb) {
+    if (sizeof(struct logheader) >= BSIZE)
+        panic("initlog: too big logheader");
+
+    initlock(&log.lock, "log");
+    log.start = sb->logstart;
+    log.dev = dev;
+    recover_from_log();
+}
+
+// Copy committed blocks from log to their home location,
+// MAXBIO at a time.
+static void install_from_log(void) {
+    struct buf *dbufs[MAXBIO];
+    int tail, i, k;
+
+    for (tail = 0; tail < log.lh.n; tail += k) {
+        for (k = 0; k < MAXBIO && tail + k < log.lh.n; k++) {
+            struct buf *lbuf = buf_read(log.dev, log.start+tail+k+1); // read log block
+            dbufs[k] = buf_get(log.dev, log.lh.block[tail+k]); // home, overwritten
+            memmove(dbufs[k]->data, lbuf->data, BSIZE);
+            buf_release(lbuf);
+        }
+        buf_writeout(dbufs, k);
+        for (i = 0; i < k; i++)
+            buf_release(dbufs[i]);
+    }
+}
+
+// Read the log header from disk into the in-memory log header
+static void read_head(void) {
+    struct buf *buf = buf_read(log.dev, log.start);
+    struct logheader *lh = (struct logheader *) (buf->data);
+    int i;
+    log.lh.n = lh->n;
+    for (i = 0; i < log.lh.n; i++) {
+        log.lh.block[i] = lh->block[i];
+    }
+    buf_release(buf);
+}
+
+// Write in-memory log header to disk.
+// This is the true point at which the
+// current transaction commits.
+static void write_head(void) {
+    struct buf *buf = buf_get(log.dev, log.start);
+    struct logheader *hb = (struct logheader *) (buf->data);
+    int i;
+    memset(buf->data, 0, BSIZE);
+    hb->n = log.lh.n;
+    for (i = 0; i < log.lh.n; i++) {
+        hb->block[i] = log.lh.block[i];
+    }
+    buf_writeout(&buf, 1);
+    buf_release(buf);
+}
+
+static void recover_from_log(void) {
+    read_head();
+    if (log.lh.n > 0)
+        printf("log: recovering %d blocks\n", log.lh.n);
+    install_from_log(); // if committed, copy from log to disk
+    log.lh.n = 0;
+    write_head(); // clear the log
+}
+
+// called at the start of each FS system call.
+void begin_op(void) {
+    acquire(&log.lock);
+    while (1) {
+        if (log.committing) {
+            sleep(&log, &log.lock);
+        } else if (log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGBLOCKS) {
+            // this op might exhaust log space; wait for commit.
+            sleep(&log, &log.lock);
+        } else {
+            log.outstanding += 1;
+            log.ops++;
+            release(&log.lock);
+            break;
+        }
+    }
+}
+
+// called at the end of each FS system call.
+// commits if this was the last outstanding operation.
+void end_op(void) {
+    int do_commit = 0;
+
+    acquire(&log.lock);
+    log.outstanding -= 1;
+    if (log.committing)
+        panic("log.committing");
+    if (log.outstanding == 0) {
+        do_commit = 1;
+        log.committing = 1;
+    } else {
+        // begin_op() may be waiting for log space,
+        // and decrementing log.outstanding has decreased
+        // the amount of reserved space.
+        wakeup(&log);
+    }
+    release(&log.lock);
+
+    if (do_commit) {
+        // call commit w/o holding locks, since not allowed
+        // to sleep with locks.
+        commit();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+        release(&log.lock);
+    }
+}
+
+// Copy modified blocks from cache to log, MAXBIO at a time.
+// the log blocks are adjacent, so each batch is one disk request.
+static void write_log(void) {
+    struct buf *to[MAXBIO];
+    int tail, i, k;
+
+    for (tail = 0; tail < log.lh.n; tail += k) {
+        for (k = 0; k < MAXBIO && tail + k < log.lh.n; k++) {
+            to[k] = buf_get(log.dev, log.start+tail+k+1); // log block
+            memmove(to[k]->data, log.buf[tail+k]->data, BSIZE);
+        }
+        buf_writeout(to, k);
+        for (i = 0; i < k; i++)
+            buf_release(to[i]);
+    }
+}
+
+// write the committed blocks to their home locations, then unpin them.
+// no FS system call is running, so nobody changes them meanwhile,
+// but readers may hold their locks, so they are written unlocked.
+static void install_trans(void) {
+    struct buf *bufs[LOGBLOCKS];
+    int i;
+
+    for (i = 0; i < log.lh.n; i++)
+        bufs[i] = log.buf[i];
+    buf_writeout(bufs, log.lh.n);
+
+    for (i = 0; i < log.lh.n; i++) {
+        buf_unpin(log.buf[i]);
+        log.buf[i] = 0;
+    }
+}
+
+static void commit() {
+    if (log.lh.n > 0) {
+        write_log();     // Write modified blocks from cache to log
+        write_head();    // Write header to disk -- the real commit
+        install_trans(); // Now install writes to home locations
+        log.lh.n = 0;
+        write_head();    // Erase the transaction from the log
+        log.commits++;
+    }
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block number and pin in the cache by increasing refcnt.
+// commit()/write_log() will do the disk write.
+//
+// log_write() replaces buf_write(); a typical use is:
+//   bp = buf_read(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   buf_release(bp)
+void log_write(struct buf *b) {
+    int i;
+
+    acquire(&log.lock);
+    if (log.lh.n >= LOGBLOCKS)
+        panic("too big a transaction");
+    if (log.outstanding < 1)
+        panic("log_write outside of trans");
+
+    for (i = 0; i < log.lh.n; i++) {
+        if (log.lh.block[i] == b->blockno) { // log absorption
+            log.absorbed++;
+            break;
+        }
+    }
+    if (i == log.lh.n) { // Add new block to log?
+        log.lh.block[i] = b->blockno;
+        log.buf[i] = b;
+        buf_pin(b);
+        log.lh.n++;
+        log.logged++;
+    }
+    release(&log.lock);
+}
+
+void log_stat(void) {
+    acquire(&log.lock);
+    printf("log: %ld ops %ld commits, %ld blocks logged %ld absorbed\n",
+           log.ops, log.commits, log.logged, log.absorbed);
+    release(&log.lock);
+}
@@ -8,17 +8,26 @@
 #include "lib/sleeplock.h"
 #include "fs/file.h"
 
-#define PIPESIZE 512
+// a new pipe's ring is in the page of its struct pipe.
+// pipesize can grow it into pmem blocks up to PIPEMAX bytes.
+// sizes are powers of 2, so the byte counts can wrap around.
+#define PIPESIZE 2048
+#define PIPEMAX  (64 * 1024)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // the ring, size bytes
+  uint size;
+  int order;      // pmem order of data, -1 if it is buf
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  char buf[PIPESIZE];
 };
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -34,6 +43,9 @@ pipealloc(struct file **f0, struct file **f1)
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->data = pi->buf;
+  pi->size = PIPESIZE;
+  pi->order = -1;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -68,6 +80,8 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    if(pi->order >= 0)
+      pmem_free_order(pi->data, pi->order);
     pmem_free((char*)pi);
   } else
     release(&pi->lock);
@@ -85,17 +99,23 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pgtbl, &ch, addr + i, 1) == -1)
+      // as much as fits up to the end of the ring
+      uint off = pi->nwrite & (pi->size - 1);
+      uint m = min(n - i, pi->size - (pi->nwrite - pi->nread));
+      m = min(m, pi->size - off);
+      if(copyin(pr->pgtbl, &pi->data[off], addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
+  // pass the rest of the room on to the next writer
+  if(pi->nwrite != pi->nread + pi->size)
+    wakeup_one(&pi->nwrite);
   wakeup(&pi->nread);
   release(&pi->lock);
 
@@ -107,7 +127,6 @@ piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +136,68 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pgtbl, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; ){  //DOC: piperead-copy
+    // as much as there is up to the end of the ring
+    uint off = pi->nread & (pi->size - 1);
+    uint m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, pi->size - off);
+    if(copyout(pr->pgtbl, addr + i, &pi->data[off], m) == -1)
       break;
+    pi->nread += m;
+    i += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeup_one(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// set the capacity of pi to n bytes, rounded up to a power of 2,
+// or only return it if n is 0.
+// returns the capacity, or -1 if n is too large or the pipe
+// holds more than n bytes.
+int
+pipesize(struct pipe *pi, int n)
+{
+  char *data, *old;
+  int order, oldorder;
+  uint size, i;
+
+  if(n == 0)
+    return pi->size;
+  if(n < 0 || n > PIPEMAX)
+    return -1;
+  for(size = PIPESIZE; size < n; size *= 2)
+    ;
+
+  if(size == PIPESIZE){
+    data = pi->buf;
+    order = -1;
+  } else {
+    for(order = 0; (PGSIZE << order) < size; order++)
+      ;
+    if((data = pmem_alloc_order(0, order)) == 0)
+      return -1;
+  }
+
+  acquire(&pi->lock);
+  if(data == pi->data || pi->nwrite - pi->nread > size){
+    release(&pi->lock);
+    if(order >= 0 && data != pi->data)
+      pmem_free_order(data, order);
+    return data == pi->data ? size : -1;
+  }
+  // the bytes keep their counts in the new ring
+  for(i = pi->nread; i != pi->nwrite; i++)
+    data[i & (size - 1)] = pi->data[i & (pi->size - 1)];
+  old = pi->data;
+  oldorder = pi->order;
+  pi->data = data;
+  pi->size = size;
+  pi->order = order;
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+
+  if(oldorder >= 0)
+    pmem_free_order(old, oldorder);
+  return size;
+}
@@ -1,14 +1,44 @@
 #include "types.h"
 #include "defs.h"
 
+// set by start() if the harts have the vector extension.
+// the rvv versions in str_rvv.S then take the calls of at least
+// RVV_MIN bytes, the shorter ones stay with the word loops.
+// the kernel does not save vector registers, so they run with
+// interrupts off and never across a yield.
+int str_rvv;
+
+#define RVV_MIN 64
+
+#define WORD 8
+#define ALIGNED(p) (((uint64)(p) & (WORD - 1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w;
+
+  if(str_rvv && n >= RVV_MIN){
+    push_off();
+    memset_rvv(dst, c, n);
+    pop_off();
+    return dst;
   }
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  w = (uchar)c * 0x0101010101010101UL;
+  for(; n >= 4*WORD; n -= 4*WORD, cdst += 4*WORD){
+    ((uint64*)cdst)[0] = w;
+    ((uint64*)cdst)[1] = w;
+    ((uint64*)cdst)[2] = w;
+    ((uint64*)cdst)[3] = w;
+  }
+  for(; n >= WORD; n -= WORD, cdst += WORD)
+    *(uint64*)cdst = w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -17,8 +47,25 @@ memcmp(const void *v1, const void *v2, uint n)
 {
   const uchar *s1, *s2;
 
+  if(str_rvv && n >= RVV_MIN){
+    int r;
+    push_off();
+    r = memcmp_rvv(v1, v2, n);
+    pop_off();
+    return r;
+  }
+
   s1 = v1;
   s2 = v2;
+  // skip equal words, the bytes find the difference
+  if(((uint64)s1 ^ (uint64)s2) % WORD == 0){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    }
+    for(; n >= WORD && *(uint64*)s1 == *(uint64*)s2; n -= WORD)
+      s1 += WORD, s2 += WORD;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -33,20 +80,52 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  int words;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  words = ((uint64)s ^ (uint64)d) % WORD == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= WORD; n -= WORD){
+        d -= WORD, s -= WORD;
+        *(uint64*)d = *(uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    // a forward copy, even overlapping, never stores ahead of its loads
+    if(str_rvv && n >= RVV_MIN){
+      push_off();
+      memcpy_rvv(d, s, n);
+      pop_off();
+      return dst;
+    }
+    if(words){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= 4*WORD; n -= 4*WORD, d += 4*WORD, s += 4*WORD){
+        uint64 a = ((uint64*)s)[0], b = ((uint64*)s)[1];
+        uint64 c = ((uint64*)s)[2], e = ((uint64*)s)[3];
+        ((uint64*)d)[0] = a;
+        ((uint64*)d)[1] = b;
+        ((uint64*)d)[2] = c;
+        ((uint64*)d)[3] = e;
+      }
+      for(; n >= WORD; n -= WORD, d += WORD, s += WORD)
+        *(uint64*)d = *(uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -99,9 +178,39 @@ safestrcpy(char *s, const char *t, int n)
 int
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
 
-  for(n = 0; s[n]; n++)
-    ;
+  if(str_rvv){
+    int n;
+    push_off();
+    n = strlen_rvv(s);
+    pop_off();
+    return n;
+  }
+
+  for(; !ALIGNED(p); p++){
+    if(*p == 0)
+      return p - s;
+  }
+  while(!HASZERO(*(uint64*)p))
+    p += WORD;
+  while(*p)
+    p++;
+  return p - s;
+}
+
+// index of the lowest set bit of x != 0
+int
+ctz64(uint64 x)
+{
+  int n = 0;
+
+  if((x & 0xffffffff) == 0){ n += 32; x >>= 32; }
+  if((x & 0xffff) == 0){ n += 16; x >>= 16; }
+  if((x & 0xff) == 0){ n += 8; x >>= 8; }
+  if((x & 0xf) == 0){ n += 4; x >>= 4; }
+  if((x & 0x3) == 0){ n += 2; x >>= 2; }
+  if((x & 0x1) == 0)
+    n += 1;
   return n;
-}
\ No newline at end of file
+}
@@ -4,45 +4,205 @@
 #include "mem/pmem.h"
 #include "memlayout.h"
 
-void freerange(void *pa_start, void *pa_end);
-
 extern char end[];  // defined by kernel.ld
 
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// reference count of every physical page, indexed by (pa - KERNBASE) / PGSIZE.
+// a page shared by copy-on-write fork is only freed when the count drops to 0.
+static int page_ref[NPAGES];
+
+#define PA2REF(pa) (page_ref[PA2IDX(pa)])
+
+// buddy state of every physical page.
+// the first page of a free block holds PG_FREE | order, every other page 0.
+static uchar page_order[NPAGES];
+
+#define PG_FREE 0x80
+
+static alloc_region_t kern_region, user_region;
+
+// per-hart page caches, [0] for kernel and [1] for user pages.
+static page_cache_t pcp[NCPU][2];
+
+static void region_init(alloc_region_t *region, char *name, uint64 start, uint64 stop);
+
 // init physical memory.
 // alloc pmem for two regions -- kernel and user region.
+// the user region sits below KERN_USER_LINE, the kernel region above it.
 void pmem_init() {
-    initlock(&kern_region.lock, "kern_region");
-    initlock(&user_region.lock, "user_region");
-    freerange(end, (void*)KERN_USER_LINE);
-    freerange((void*)KERN_USER_LINE, (void*)PHYSTOP);
+    region_init(&user_region, "user_region", PGROUNDUP((uint64)end), KERN_USER_LINE);
+    region_init(&kern_region, "kern_region", KERN_USER_LINE, PHYSTOP);
+}
+
+// the region a physical address belongs to, and its type.
+static alloc_region_t* pa2region(uint64 pa, int *type) {
+    if (pa < KERN_USER_LINE) {
+        *type = 1;
+        return &user_region;
+    }
+    *type = 0;
+    return &kern_region;
+}
+
+/*** buddy free lists, region->lock must be held ***/
 
-    // look the top 5 free page in list. for debug.
-    // page_node_t *u = user_region.free_list;
-    // page_node_t *k = kern_region.free_list;
-    // for (int i = 0; i < 5; i++) {
-    //     printf("User list # %d: %p\n", i, u);
-    //     printf("Kernel list # %d: %p\n", i, k);
-    //     u = u->next;
-    //     k = k->next;
-    // }
+static void area_push(alloc_region_t *region, page_node_t *p, int order) {
+    p->prev = 0;
+    p->next = region->free_area[order];
+    if (p->next)
+        p->next->prev = p;
+    region->free_area[order] = p;
+    region->nfree[order]++;
+    page_order[PA2IDX(p)] = PG_FREE | order;
 }
 
-void freerange(void *pa_start, void *pa_end) {
-    if (((uint64)pa_start < KERN_USER_LINE) && ((uint64)pa_end > KERN_USER_LINE))
-        panic("freerange");
+static void area_remove(alloc_region_t *region, page_node_t *p, int order) {
+    if (p->prev)
+        p->prev->next = p->next;
+    else
+        region->free_area[order] = p->next;
+    if (p->next)
+        p->next->prev = p->prev;
+    region->nfree[order]--;
+    page_order[PA2IDX(p)] = 0;
+}
+
+// take a block of 2^order pages, splitting a larger one if needed.
+// return 0 if there is no such block.
+static void* buddy_alloc(alloc_region_t *region, int order) {
+    page_node_t *p;
+    int k;
+
+    for (k = order; k <= PMEM_MAX_ORDER; k++) {
+        if (region->free_area[k])
+            break;
+    }
+    if (k > PMEM_MAX_ORDER)
+        return 0;
+
+    p = region->free_area[k];
+    area_remove(region, p, k);
+
+    // give the upper halves back
+    while (k > order) {
+        k--;
+        area_push(region, (page_node_t*)((char*)p + ((uint64)PGSIZE << k)), k);
+    }
+
+    region->num -= 1 << order;
+    return (void*)p;
+}
 
-    char *p;
-    p = (char*)PGROUNDUP((uint64)pa_start);
-    for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-        pmem_free(p);
+// return a block of 2^order pages, merging it with its free buddies.
+static void buddy_free(alloc_region_t *region, void *pa, int order) {
+    uint64 off = ((uint64)pa - region->begin) / PGSIZE;
+
+    if (page_order[PA2IDX(pa)] & PG_FREE)
+        panic("buddy_free: free block");
+
+    region->num += 1 << order;
+    while (order < PMEM_MAX_ORDER) {
+        uint64 buddy = region->begin + (off ^ (1L << order)) * PGSIZE;
+        if (buddy + ((uint64)PGSIZE << order) > region->end)
+            break;
+        if (page_order[PA2IDX(buddy)] != (PG_FREE | order))
+            break;
+        area_remove(region, (page_node_t*)buddy, order);
+        off &= ~(1L << order);
+        order++;
+    }
+    area_push(region, (page_node_t*)(region->begin + off * PGSIZE), order);
+}
+
+// split [begin, end) into the largest aligned blocks.
+static void region_init(alloc_region_t *region, char *name, uint64 start, uint64 stop) {
+    uint64 npages, off;
+    int k;
+
+    initlock(&region->lock, name);
+    region->begin = start;
+    region->end = stop;
+
+    npages = (stop - start) / PGSIZE;
+    for (off = 0; off < npages; off += 1L << k) {
+        for (k = PMEM_MAX_ORDER; k > 0; k--) {
+            if ((off & ((1L << k) - 1)) == 0 && off + (1L << k) <= npages)
+                break;
+        }
+        area_push(region, (page_node_t*)(start + off * PGSIZE), k);
+        region->num += 1 << k;
+    }
+}
+
+// fill a newly allocated block as the pmem_alloc flags ask.
+// without flags only debug builds write junk.
+static void alloc_fill(void *pa, uint64 sz, int flags) {
+    if (flags & PMEM_ZERO) {
+        memset(pa, 0, sz);
+        return;
+    }
+#ifdef PMEM_DEBUG
+    if ((flags & PMEM_NOFILL) == 0)
+        memset(pa, 5, sz);
+#endif
+}
+
+/*** per-hart caches of single pages ***/
+
+// take the region lock, counting contention on the caller's cache.
+static void region_lock(alloc_region_t *region, page_cache_t *c) {
+    if (region->lock.locked)
+        c->lock_waits++;
+    acquire(&region->lock);
+}
+
+// move up to PCP_BATCH pages from the region to cache c.
+// interrupts must be off.
+static void pcp_refill(alloc_region_t *region, page_cache_t *c) {
+    page_node_t *p;
+
+    region_lock(region, c);
+    for (int i = 0; i < PCP_BATCH; i++) {
+        if ((p = buddy_alloc(region, 0)) == 0)
+            break;
+        p->next = c->list;
+        c->list = p;
+        c->num++;
+    }
+    release(&region->lock);
+    c->refills++;
+}
+
+// give PCP_BATCH pages of cache c back to the region.
+// interrupts must be off.
+static void pcp_drain(alloc_region_t *region, page_cache_t *c) {
+    page_node_t *p;
+
+    region_lock(region, c);
+    for (int i = 0; i < PCP_BATCH && c->num > 0; i++) {
+        p = c->list;
+        c->list = p->next;
+        c->num--;
+        buddy_free(region, p, 0);
+    }
+    release(&region->lock);
+    c->drains++;
 }
 
 // alloc a free page from kernel or user free page linklist
 // depending on type, 0 for kernel, 1 for user
+// or-ed with PMEM_ZERO or PMEM_NOFILL.
+// the page comes from this hart's cache, which is refilled
+// from the region in batches.
 void* pmem_alloc(int type) {
     page_node_t *p;
     alloc_region_t *region;
+    page_cache_t *c;
+    int flags = type & (PMEM_ZERO | PMEM_NOFILL);
 
+    type &= ~flags;
     if (type == 0) {
         region = &kern_region;
     } else if (type == 1) {
@@ -51,17 +211,44 @@ void* pmem_alloc(int type) {
         panic("pmem_alloc");
     }
 
-    acquire(&region->lock);
-    p = region->free_list;
-    
-    if (region->num > 0) {
-        region->free_list = p->next;  
-        region->num--;
+    push_off();
+    c = &pcp[cpuid()][type];
+    if ((flags & PMEM_ZERO) && c->znum > 0) {
+        // already zeroed by pmem_zero_idle
+        p = c->zlist;
+        c->zlist = p->next;
+        c->znum--;
+        c->zhits++;
+        pop_off();
+        p->next = 0;
+        PA2REF(p) = 1;
+        return (void*)p;
+    }
+
+    if (c->num == 0)
+        pcp_refill(region, c);
+    else
+        c->hits++;
+
+    p = c->list;
+    if (p) {
+        c->list = p->next;
+        c->num--;
+        if (flags & PMEM_ZERO)
+            c->zmisses++;
+    } else if ((p = c->zlist) != 0) {
+        // the region is dry, fall back on the zeroed pool
+        c->zlist = p->next;
+        c->znum--;
     }
-    release (&region->lock);
+    pop_off();
 
     if (p) {
-        memset((char*)p, 5, PGSIZE);
+        PA2REF(p) = 1;
+        alloc_fill(p, PGSIZE, flags);
+    } else if (type == 1 && buf_reclaim(PCP_BATCH) > 0) {
+        // user memory ran out, shrink the buffer cache and retry
+        return pmem_alloc(type | flags);
     }
 
     return (void*)p;
@@ -70,24 +257,197 @@ void* pmem_alloc(int type) {
 void pmem_free(void *pa) {
     page_node_t *p;
     alloc_region_t *region;
+    page_cache_t *c;
+    int type;
 
-    if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa > PHYSTOP) {
+    if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP) {
         panic("pmem_free");
     }
 
+    // still mapped by another page table
+    int ref = __sync_sub_and_fetch(&PA2REF(pa), 1);
+    if (ref < 0)
+        panic("pmem_free: ref");
+    if (ref > 0)
+        return;
+
+#ifdef PMEM_DEBUG
     memset(pa, 1, PGSIZE);
+#endif
+
+    region = pa2region((uint64)pa, &type);
+    p = (page_node_t*) pa;
+
+    push_off();
+    c = &pcp[cpuid()][type];
+    p->next = c->list;
+    c->list = p;
+    c->num++;
+    if (c->num > PCP_HIGH)
+        pcp_drain(region, c);
+    pop_off();
+}
 
-    if ((uint64)pa < KERN_USER_LINE) {
+// alloc 2^order physically contiguous pages,
+// type as pmem_alloc. return 0 if out of memory.
+// order 0 goes through the per-hart cache like pmem_alloc.
+void* pmem_alloc_order(int type, int order) {
+    alloc_region_t *region;
+    void *pa;
+    int flags = type & (PMEM_ZERO | PMEM_NOFILL);
+
+    if (order == 0)
+        return pmem_alloc(type);
+
+    type &= ~flags;
+    if (order < 0 || order > PMEM_MAX_ORDER)
+        panic("pmem_alloc_order: order");
+    if (type == 0) {
+        region = &kern_region;
+    } else if (type == 1) {
         region = &user_region;
     } else {
-        region = &kern_region;
+        panic("pmem_alloc_order");
     }
 
-    p = (page_node_t*) pa;
-    
     acquire(&region->lock);
-    p->next = region->free_list;
-    region->free_list = p;
-    region->num++;
+    pa = buddy_alloc(region, order);
+    release(&region->lock);
+
+    if (pa) {
+        PA2REF(pa) = 1;
+        alloc_fill(pa, (uint64)PGSIZE << order, flags);
+    }
+    return pa;
+}
+
+// free a block from pmem_alloc_order with the same order.
+void pmem_free_order(void *pa, int order) {
+    alloc_region_t *region;
+    int type;
+
+    if (order == 0) {
+        pmem_free(pa);
+        return;
+    }
+
+    if (order < 0 || order > PMEM_MAX_ORDER || (char*)pa < end ||
+        (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+        panic("pmem_free_order");
+    region = pa2region((uint64)pa, &type);
+    if ((((uint64)pa - region->begin) / PGSIZE) & ((1L << order) - 1))
+        panic("pmem_free_order: align");
+
+    int ref = __sync_sub_and_fetch(&PA2REF(pa), 1);
+    if (ref < 0)
+        panic("pmem_free_order: ref");
+    if (ref > 0)
+        return;
+
+#ifdef PMEM_DEBUG
+    memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+
+    acquire(&region->lock);
+    buddy_free(region, pa, order);
     release(&region->lock);
 }
+
+// zero one free user page into this hart's pool for PMEM_ZERO.
+// called by the scheduler when there is nothing to run,
+// so vm_u_alloc and sys_mmap rarely zero pages themselves.
+// returns 1 if a page was zeroed, 0 if the pool is full or memory is out.
+int pmem_zero_idle(void) {
+    page_node_t *p;
+    page_cache_t *c;
+
+    push_off();
+    c = &pcp[cpuid()][1];
+    if (c->znum >= ZPOOL_HIGH) {
+        pop_off();
+        return 0;
+    }
+    if (c->num == 0)
+        pcp_refill(&user_region, c);
+    if ((p = c->list) == 0) {
+        pop_off();
+        return 0;
+    }
+    c->list = p->next;
+    c->num--;
+
+    memset(p, 0, PGSIZE);
+    p->next = c->zlist;
+    c->zlist = p;
+    c->znum++;
+    pop_off();
+    return 1;
+}
+
+// approximate number of free pages of type 0 (kernel) or 1 (user),
+// including the ones in per-hart caches.
+uint64 pmem_nfree(int type) {
+    alloc_region_t *region = type == 0 ? &kern_region : &user_region;
+    uint64 n = region->num;
+
+    for (int i = 0; i < NCPU; i++)
+        n += pcp[i][type].num + pcp[i][type].znum;
+    return n;
+}
+
+// give every page in this hart's cache of type back to the
+// buddy lists, so they can merge. the zeroed pool stays.
+void pmem_drain(int type) {
+    alloc_region_t *region = type == 0 ? &kern_region : &user_region;
+    page_cache_t *c;
+
+    push_off();
+    c = &pcp[cpuid()][type];
+    while (c->num > 0)
+        pcp_drain(region, c);
+    pop_off();
+}
+
+// copy the number of free blocks of each order of type
+// into nfree[0..PMEM_MAX_ORDER].
+void pmem_nblocks(int type, uint *nfree) {
+    alloc_region_t *region = type == 0 ? &kern_region : &user_region;
+
+    acquire(&region->lock);
+    for (int k = 0; k <= PMEM_MAX_ORDER; k++)
+        nfree[k] = region->nfree[k];
+    release(&region->lock);
+}
+
+// take one more reference to an allocated page.
+void pmem_ref(void *pa) {
+    if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+        panic("pmem_ref");
+    __sync_fetch_and_add(&PA2REF(pa), 1);
+}
+
+// current reference count of a page.
+int pmem_refcnt(void *pa) {
+    return PA2REF(pa);
+}
+
+static void region_stat(char *name, alloc_region_t *region) {
+    printf("pmem: %s free %d, blocks by order:", name, region->num);
+    for (int k = 0; k <= PMEM_MAX_ORDER; k++)
+        printf(" %d", region->nfree[k]);
+    printf("\n");
+}
+
+// print free page counts and per-hart cache statistics.
+void pmem_stat(void) {
+    region_stat("kern", &kern_region);
+    region_stat("user", &user_region);
+    for (int i = 0; i < NCPU; i++) {
+        for (int t = 0; t < 2; t++) {
+            page_cache_t *c = &pcp[i][t];
+            printf("  cpu %d %s: cached %d hits %ld refills %ld drains %ld lock waits %ld\n",
+                   i, t == 0 ? "kern" : "user", c->num, c->hits, c->refills, c->drains, c->lock_waits);
+            printf("    zeroed %d zero hits %ld zero misses %ld\n", c->znum, c->zhits, c->zmisses);
+        }
+    }
+}
@@ -18,8 +18,7 @@ kvmmake(void)
 {
   pagetbl_t kpgtbl;
 
-  kpgtbl = (pagetbl_t) pmem_alloc(0);
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetbl_t) pmem_alloc(0 | PMEM_ZERO);
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -113,9 +112,8 @@ pte_t* vm_getpte(pagetbl_t pagetable, uint64 va, int alloc) {
     if(*pte & PTE_V) {
       pagetable = (pagetbl_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pte_t*)pmem_alloc(0)) == 0)
+      if(!alloc || (pagetable = (pte_t*)pmem_alloc(0 | PMEM_ZERO)) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -172,35 +170,68 @@ int vm_mappages(pagetbl_t pagetable, uint64 va, uint64 size, uint64 pa, int perm
   return 0;
 }
 
-void vm_unmappages(pagetbl_t pagetable, uint64 va, uint64 npages, int do_free) {
-  uint64 a;
-  pte_t *pte;
+// helper function of vm_walk
+static int vm_walk_level(pagetbl_t pagetable, int level, uint64 base,
+                         uint64 start, uint64 end, vm_walk_fn fn, void *arg) {
+    uint64 span = 1L << PXSHIFT(level);
+    int i, r;
 
-  if((va % PGSIZE) != 0)
-    panic("uvmunmap: not aligned");
+    i = (start > base) ? (start - base) / span : 0;
+    for (; i < 512; i++) {
+        uint64 va = base + i * span;
+        pte_t *pte = &pagetable[i];
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = vm_getpte(pagetable, a, 0)) == 0) // leaf page table entry allocated?
-      continue;   
-    if((*pte & PTE_V) == 0)  // has physical page been allocated?
-      continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      pmem_free((void*)pa);
+        if (va >= end)
+            break;
+        if ((*pte & PTE_V) == 0)
+            continue;  // the whole subtree is absent
+        if (level == 0) {
+            r = fn(pte, va, arg);
+        } else {
+            if (*pte & (PTE_R | PTE_W | PTE_X))
+                panic("vm_walk: leaf");
+            r = vm_walk_level((pagetbl_t)PTE2PA(*pte), level - 1, va, start, end, fn, arg);
+        }
+        if (r != 0)
+            return r;
     }
+    return 0;
+}
+
+// call fn on every valid leaf PTE mapping [va, va + sz).
+// recurses the Sv39 tree and skips invalid interior PTEs in one step,
+// so the cost scales with the mapped pages instead of sz.
+// stops at the first non-zero return of fn and returns it.
+int vm_walk(pagetbl_t pagetable, uint64 va, uint64 sz, vm_walk_fn fn, void *arg) {
+    if (va >= MAXVA || sz == 0)
+        return 0;
+    if (sz > MAXVA - va)
+        sz = MAXVA - va;
+    return vm_walk_level(pagetable, 2, 0, va, va + sz, fn, arg);
+}
+
+static int unmap_leaf(pte_t *pte, uint64 va, void *do_free) {
+    if (do_free)
+        pmem_free((void*)PTE2PA(*pte));
     *pte = 0;
-  }
+    return 0;
+}
+
+void vm_unmappages(pagetbl_t pagetable, uint64 va, uint64 npages, int do_free) {
+  if((va % PGSIZE) != 0)
+    panic("uvmunmap: not aligned");
+
+  vm_walk(pagetable, va, npages*PGSIZE, unmap_leaf, (void*)(uint64)do_free);
 }
 
 // create an empty user page table
 // return 0 if out of memory
 pagetbl_t vm_upage_create() {
     pagetbl_t pagetable;
-    pagetable = (pagetbl_t) pmem_alloc(1);
+    pagetable = (pagetbl_t) pmem_alloc(1 | PMEM_ZERO);
     if(pagetable == 0) {
         return 0;
     }
-    memset(pagetable, 0, PGSIZE);
     return pagetable;
 }
 
@@ -240,12 +271,11 @@ uint64 vm_u_alloc(pagetbl_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
 
     oldsz = PGROUNDUP(oldsz);
     for (a = oldsz; a < newsz; a += PGSIZE) {
-        mem = pmem_alloc(1);
+        mem = pmem_alloc(1 | PMEM_ZERO);
         if (mem == 0) {
             vm_u_dealloc(pagetable, a, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
         if(vm_mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
             pmem_free(mem);
             vm_u_dealloc(pagetable, a, oldsz);
@@ -269,6 +299,19 @@ uint64 vm_u_dealloc(pagetbl_t pagetable, uint64 oldsz, uint64 newsz) {
     return newsz;
 }
 
+static int copy_leaf(pte_t *pte, uint64 va, void *new) {
+    char *mem;
+
+    if ((mem = pmem_alloc(1 | PMEM_NOFILL)) == 0)
+        return -1;
+    memmove(mem, (char*)PTE2PA(*pte), PGSIZE);
+    if (vm_mappages((pagetbl_t)new, va, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0) {
+        pmem_free(mem);
+        return -1;
+    }
+    return 0;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
@@ -276,33 +319,120 @@ uint64 vm_u_dealloc(pagetbl_t pagetable, uint64 oldsz, uint64 newsz) {
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 // Used in these cases:
-//   1. to fork a proc, you need to do a vm_u_copy.
+//   1. the eager fork path, see bench_fork.
 int vm_u_copy(pagetbl_t old, pagetbl_t new, uint64 sz) {
+    if (vm_walk(old, 0, sz, copy_leaf, new) != 0) {
+        vm_unmappages(new, 0, PGROUNDUP(sz) / PGSIZE, 1);
+        return -1;
+    }
+    return 0;
+}
+
+static int share_leaf(pte_t *pte, uint64 va, void *new) {
+    uint64 pa;
+
+    if (*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE2PA(*pte);
+    if (vm_mappages((pagetbl_t)new, va, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        return -1;
+    pmem_ref((void*)pa);
+    return 0;
+}
+
+// Copy-on-write version of vm_u_copy.
+// Map the parent's physical pages into the child instead of copying them.
+// Writable pages become read-only and PTE_COW in both page tables,
+// the first store to them is handled by vm_cow_fault().
+// returns 0 on success, -1 on failure.
+// frees any mapped pages on failure.
+// Used in these cases:
+//   1. kfork.
+int vm_u_share(pagetbl_t old, pagetbl_t new, uint64 sz) {
+    if (vm_walk(old, 0, sz, share_leaf, new) != 0) {
+        vm_unmappages(new, 0, PGROUNDUP(sz) / PGSIZE, 1);
+        return -1;
+    }
+    return 0;
+}
+
+// Resolve a store to a copy-on-write page at va.
+// The page is copied unless this page table holds the only reference,
+// in which case it is simply made writable again.
+// returns 0 on success, -1 if va is not a COW page or out of memory.
+// Used in these cases:
+//   1. store page fault from user mode.
+//   2. copyout to a COW page.
+int vm_cow_fault(pagetbl_t pagetable, uint64 va) {
     pte_t *pte;
-    uint64 pa, i;
+    uint64 pa;
     uint flags;
     char *mem;
 
-    for (i = 0; i < sz; i += PGSIZE) {
-        if ((pte = vm_getpte(old, i, 0)) == 0)
-            continue;
-        if ((*pte & PTE_V) == 0)
-            continue;
-        pa = PTE2PA(*pte);
-        flags = PTE_FLAGS(*pte);
-        if ((mem = pmem_alloc(1)) == 0)
-            goto err;
-        memmove(mem, (char*)pa, PGSIZE);
-        if (vm_mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-            pmem_free(mem);
-            goto err;
-        }
+    if (va >= MAXVA)
+        return -1;
+
+    pte = vm_getpte(pagetable, PGROUNDDOWN(va), 0);
+    if (pte == 0)
+        return -1;
+    if ((*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+        return -1;
+
+    pa = PTE2PA(*pte);
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    if (pmem_refcnt((void*)pa) == 1) {
+        *pte = PA2PTE(pa) | flags;
+        return 0;
     }
+
+    if ((mem = pmem_alloc(1 | PMEM_NOFILL)) == 0)
+        return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    pmem_free((void*)pa);
     return 0;
+}
 
-err:
-    vm_unmappages(new, 0, i / PGSIZE, 1);
-    return -1;
+// the kernel address of the user page at va0, with one page
+// table walk. a store first breaks copy-on-write.
+// returns 0 if the page is not mapped for user (write) access.
+static char* upage(pagetbl_t pagetable, uint64 va0, int write) {
+    pte_t *pte;
+
+    if (va0 >= MAXVA)
+        return 0;
+    pte = vm_getpte(pagetable, va0, 0);
+    if (pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+        return 0;
+    if (write) {
+        if ((*pte & PTE_COW) && vm_cow_fault(pagetable, va0) < 0)
+            return 0;
+        if ((*pte & PTE_W) == 0)
+            return 0;
+    }
+    return (char*)PTE2PA(*pte);
+}
+
+// copy n bytes between a user page and the kernel, which never
+// overlap, a word at a time when both are equally aligned.
+static void ucopy(char *dst, const char *src, uint64 n) {
+    if ((((uint64)dst ^ (uint64)src) & 7) == 0) {
+        for (; n > 0 && ((uint64)dst & 7); n--)
+            *dst++ = *src++;
+        for (; n >= 32; n -= 32, dst += 32, src += 32) {
+            uint64 a = ((uint64*)src)[0], b = ((uint64*)src)[1];
+            uint64 c = ((uint64*)src)[2], d = ((uint64*)src)[3];
+            ((uint64*)dst)[0] = a;
+            ((uint64*)dst)[1] = b;
+            ((uint64*)dst)[2] = c;
+            ((uint64*)dst)[3] = d;
+        }
+        for (; n >= 8; n -= 8, dst += 8, src += 8)
+            *(uint64*)dst = *(uint64*)src;
+    }
+    while (n-- > 0)
+        *dst++ = *src++;
 }
 
 // Copy from kernel to user.
@@ -311,27 +441,18 @@ err:
 // Used in these cases:
 //   1. kwait syscall. copy the xstate of the child proc to parent proc's given addr.
 int copyout(pagetbl_t pagetable, uint64 dstva, char *src, uint64 len) {
-    uint64 n, va0, pa0;
-    pte_t *pte;
+    uint64 n, va0;
+    char *pa0;
 
     while (len > 0) {
         va0 = PGROUNDDOWN(dstva);
-        if (va0 >= MAXVA)
-            return -1;
-
-        pa0 = vm_getpa(pagetable, va0);
-        if (pa0 == 0) {
-            return -1;
-        }
-
-        pte = vm_getpte(pagetable, va0, 0);
-        if ((*pte & PTE_W) == 0)
+        if ((pa0 = upage(pagetable, va0, 1)) == 0)
             return -1;
 
-        n = PGSIZE - (dstva -va0);
+        n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
-        memmove((void*)(pa0 + (dstva - va0)), src, n);
+        ucopy(pa0 + (dstva - va0), src, n);
 
         len -= n;
         src += n;
@@ -347,40 +468,36 @@ int copyout(pagetbl_t pagetable, uint64 dstva, char *src, uint64 len) {
 int
 copyinstr(pagetbl_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  uint64 n, va0;
+  char *pa0;
 
-  while(got_null == 0 && max > 0){
+  while(max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = vm_getpa(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = upage(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
-
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
+    max -= n;
+
+    char *p = pa0 + (srcva - va0);
+    // whole words while neither holds the '\0'
+    if((((uint64)p ^ (uint64)dst) & 7) == 0){
+      for(; n > 0 && ((uint64)p & 7); n--, p++, dst++){
+        if((*dst = *p) == '\0')
+          return 0;
       }
-      --n;
-      --max;
-      p++;
-      dst++;
+      for(; n >= 8 && !HASZERO(*(uint64*)p); n -= 8, p += 8, dst += 8)
+        *(uint64*)dst = *(uint64*)p;
+    }
+    for(; n > 0; n--, p++, dst++){
+      if((*dst = *p) == '\0')
+        return 0;
     }
 
     srcva = va0 + PGSIZE;
   }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
-  }
+  return -1;
 }
 
 // allocate and map user memory if process is referencing a page
@@ -433,18 +550,17 @@ copyinstr(pagetbl_t pagetable, char *dst, uint64 srcva, uint64 max)
 int
 copyin(pagetbl_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0;
+  char *pa0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = vm_getpa(pagetable, va0);
-    if(pa0 == 0) {
-        return -1;
-    }
+    if((pa0 = upage(pagetable, va0, 0)) == 0)
+      return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    ucopy(dst, pa0 + (srcva - va0), n);
 
     len -= n;
     dst += n;
@@ -35,11 +35,11 @@ kexec(char *path, char **argv)
   pagetbl_t pagetable = 0, oldpagetable;
   proc_t *p = myproc();
 
-  //begin_op();
+  begin_op();
 
   // Open the executable file.
   if((ip = namei(path)) == 0){
-    //end_op();
+    end_op();
     return -1;
   }
   ilock(ip);
@@ -75,7 +75,7 @@ kexec(char *path, char **argv)
       goto bad;
   }
   iunlockput(ip);
-  //end_op();
+  end_op();
   ip = 0;
 
   p = myproc();
@@ -142,7 +142,7 @@ kexec(char *path, char **argv)
     proc_free_pagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
-    //end_op();
+    end_op();
   }
   return -1;
 }
@@ -156,6 +156,11 @@ loadseg(pagetbl_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
 {
   uint i, n;
   uint64 pa;
+  struct readahead ra;
+
+  // segments are read in order, prefetch ahead of the copy
+  memset(&ra, 0, sizeof(ra));
+  ra.next = offset / BSIZE;
 
   for(i = 0; i < sz; i += PGSIZE){
     pa = vm_getpa(pagetable, va + i);
@@ -167,6 +172,7 @@ loadseg(pagetbl_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
       n = PGSIZE;
     if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
       return -1;
+    ireadahead(ip, &ra, offset+i, n);
   }
   
   return 0;
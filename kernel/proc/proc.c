@@ -59,6 +59,200 @@ spinlock_t pid_lock;
 //    causing the parent to miss the wakeup notification.
 spinlock_t wait_lock;
 
+/*** run queues ***/
+
+// each hart has a queue of RUNNABLE processes, so the scheduler
+// takes one lock to pick a process instead of scanning the proc
+// table. a process is queued on the hart it last ran on, and a
+// hart whose queue is empty steals from the longest other one.
+// lock order: p->lock, then a run queue lock.
+// the counters and minv are only changed by the hart that owns
+// the queue.
+//
+// the queues are fair-share: sorted by vruntime, the cpu time a
+// process used scaled down by its weight, so the process that got
+// the least of its share runs next. a process waking up from sleep
+// is placed at most SLEEP_CREDIT before the queue's minv, so an
+// interactive process goes ahead of the batch ones but cannot save
+// up for a long run.
+typedef struct runq {
+    spinlock_t lock;
+    proc_t *head;
+    proc_t *tail;
+    int len;
+    uint64 minv;     // vruntime of the last process picked here
+    uint64 runs;     // processes this hart ran
+    uint64 steals;   // of those, taken from another hart's queue
+    uint64 wait;     // total time from RUNNABLE to RUNNING
+    uint64 maxwait;
+} runq_t;
+
+static runq_t runq[NCPU];
+
+#define NICE0_WEIGHT 1024
+#define SLEEP_CREDIT TICK
+#define SCHED_GRAN   (TICK / 2)  // vruntime lead that preempts
+
+// the weight of nice -20..19, each step about 10% cpu (as Linux)
+static const int nice_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+// ran time units of cpu, in vruntime
+static uint64 scaled(proc_t *p, uint64 ran) {
+    return ran * NICE0_WEIGHT / nice_weight[p->nice + 20];
+}
+
+// charge the running process p for the cpu time since p->lastrun.
+// caller must hold p->lock.
+static void charge(proc_t *p) {
+    uint64 now = r_time();
+
+    p->runtime += now - p->lastrun;
+    p->vruntime += scaled(p, now - p->lastrun);
+    p->lastrun = now;
+}
+
+// make p RUNNABLE and queue it on p->cpu in vruntime order,
+// after those with the same vruntime.
+// credit is how far p may be placed before the queue's minv.
+// caller must hold p->lock.
+static void make_runnable(proc_t *p, uint64 credit) {
+    runq_t *rq = &runq[p->cpu];
+    proc_t **pp;
+
+    p->state = RUNNABLE;
+    p->rqtime = r_time();
+    acquire(&rq->lock);
+    if (rq->minv > credit && p->vruntime < rq->minv - credit)
+        p->vruntime = rq->minv - credit;
+    for (pp = &rq->head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+        ;
+    p->rqnext = *pp;
+    *pp = p;
+    if (p->rqnext == 0)
+        rq->tail = p;
+    rq->len++;
+    release(&rq->lock);
+}
+
+// take the first process off rq, or return 0.
+static proc_t* runq_pop(runq_t *rq) {
+    proc_t *p;
+
+    acquire(&rq->lock);
+    if ((p = rq->head) != 0) {
+        if ((rq->head = p->rqnext) == 0)
+            rq->tail = 0;
+        rq->len--;
+    }
+    release(&rq->lock);
+    return p;
+}
+
+// take a process from the longest queue of another hart, or return 0.
+// the lengths are read unlocked, they only pick the victim.
+// the caller moves its vruntime to hart id's scale.
+static proc_t* runq_steal(int id, runq_t **victim) {
+    int i, len = 0;
+
+    *victim = 0;
+    for (i = 0; i < NCPU; i++) {
+        if (i != id && runq[i].len > len) {
+            *victim = &runq[i];
+            len = runq[i].len;
+        }
+    }
+    return *victim ? runq_pop(*victim) : 0;
+}
+
+// called on a timer interrupt: should the running process give
+// up the cpu? yes if the first process queued on this hart is
+// behind it in vruntime by more than SCHED_GRAN, such as an
+// interactive process that just woke up, or the next of equal
+// batch processes after a tick.
+int sched_preempt(void) {
+    proc_t *p = myproc();
+    runq_t *rq;
+    uint64 v;
+    int r;
+
+    if (p == 0)
+        return 0;
+    // only this hart changes p's accounting while it runs
+    v = p->vruntime + scaled(p, r_time() - p->lastrun);
+    rq = &runq[cpuid()];
+    acquire(&rq->lock);
+    r = rq->head && rq->head->vruntime + SCHED_GRAN < v;
+    release(&rq->lock);
+    return r;
+}
+
+// set the nice value of the current process.
+// returns the old one, or -1 if n is out of range.
+int proc_nice(int n) {
+    proc_t *p = myproc();
+    int old;
+
+    if (n < -20 || n > 19)
+        return -1;
+    acquire(&p->lock);
+    charge(p);
+    old = p->nice;
+    p->nice = n;
+    release(&p->lock);
+    return old;
+}
+
+// print the run queue length, runs, steals and the scheduling
+// latency (RUNNABLE to RUNNING, in time units) of each hart,
+// and the cpu accounting of each process.
+void sched_stat(void) {
+    for (int i = 0; i < NCPU; i++) {
+        runq_t *rq = &runq[i];
+        if (rq->runs == 0 && rq->len == 0)
+            continue;
+        printf("cpu %d: %d queued, %ld runs, %ld stolen, latency avg %ld max %ld\n",
+               i, rq->len, rq->runs, rq->steals,
+               rq->wait / (rq->runs ? rq->runs : 1), rq->maxwait);
+    }
+    for (proc_t *p = proc; p < &proc[NPROC]; p++) {
+        if (p->state != UNUSED)
+            printf("pid %d: nice %d runtime %ld vruntime %ld\n",
+                   p->pid, p->nice, p->runtime, p->vruntime);
+    }
+}
+
+/*** sleep queues ***/
+
+// sleeping processes are queued by a hash of their channel, so
+// wakeup looks only at the sleepers in one bucket instead of
+// locking every proc. each queue is FIFO, wakeup_one wakes the
+// process that has slept longest.
+// lock order: the condition lock, p->lock, then a sleep queue lock.
+#define NSLEEPQ 64
+
+typedef struct sleepq {
+    spinlock_t lock;
+    proc_t *head;
+    proc_t *tail;
+} sleepq_t;
+
+static sleepq_t sleepq[NSLEEPQ];
+
+static sleepq_t* sleepq_of(void *chan) {
+    uint64 h = (uint64)chan;
+
+    return &sleepq[((h >> 3) ^ (h >> 11)) % NSLEEPQ];
+}
+
 int alloc_pid() {
     int pid;
 
@@ -91,6 +285,10 @@ void proc_init(void) {
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&runq[i].lock, "runq");
+    for (int i = 0; i < NSLEEPQ; i++)
+        initlock(&sleepq[i].lock, "sleepq");
     for (p = proc; p < &proc[NPROC]; p++) {
         initlock(&p->lock, "proc");
         p->state = UNUSED;
@@ -150,6 +348,10 @@ static void free_proc(proc_t *p) {
     p->chan = 0;
     p->killed = 0;
     p->xstate = 0;
+    p->kfn = 0;
+    p->nice = 0;
+    p->vruntime = 0;
+    p->runtime = 0;
     p->state = UNUSED;
 }
 
@@ -172,16 +374,16 @@ static proc_t* alloc_proc(void) {
 
 found:
     p->pid = alloc_pid();
-    //p->state = USED;
-    p->state = RUNNABLE;
+    // not RUNNABLE until it is set up and queued
+    p->state = USED;
+    p->cpu = cpuid();
 
     // trapframe
-    if ((p->trapframe = (trapframe_t *)pmem_alloc(1)) == 0) {
+    if ((p->trapframe = (trapframe_t *)pmem_alloc(1 | PMEM_ZERO)) == 0) {
         free_proc(p);
         release(&p->lock);
         return 0;
     }
-    memset((void*)p->trapframe, 0, PGSIZE);
 
     // pagetable
     if ((p->pgtbl = proc_pgtbl_init((uint64)(p->trapframe))) == 0) {
@@ -261,7 +463,9 @@ void kexit(int status) {
             p->ofile[fd] = 0;
         }
     }
+    begin_op();
     iput(p->cwd);
+    end_op();
     p->cwd = 0;
 
     acquire(&wait_lock);
@@ -274,6 +478,7 @@ void kexit(int status) {
 
     acquire(&p->lock);
 
+    charge(p);
     p->xstate = status;
     p->state = ZOMBIE;
 
@@ -295,7 +500,8 @@ int kfork() {
         return -1;
     }
 
-    if (vm_u_copy(p->pgtbl, np->pgtbl, MAXVA - 2 * PGSIZE) < 0) {
+    // share the parent's pages copy-on-write
+    if (vm_u_share(p->pgtbl, np->pgtbl, MAXVA - 2 * PGSIZE) < 0) {
         free_proc(np);
         release(&np->lock);
         return -1;
@@ -303,6 +509,10 @@ int kfork() {
     np->heap_top = p->heap_top;
     //np->ustack_pages = p->ustack_pages;
 
+    // the child starts with the parent's share
+    np->nice = p->nice;
+    np->vruntime = p->vruntime;
+
     // copy saved user registers
     *(np->trapframe) = *(p->trapframe);
 
@@ -326,12 +536,38 @@ int kfork() {
     release(&wait_lock);
 
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    make_runnable(np, 0);
     release(&np->lock);
 
     return pid;
 }
 
+// first scheduling of a kernel thread.
+static void kthread_entry(void) {
+    proc_t *p = myproc();
+
+    release(&p->lock);
+    p->kfn();
+    panic("kthread returned");
+}
+
+// Create a process that runs fn in the kernel and never
+// returns to user space. fn must not return.
+// Returns its pid, or -1.
+int kthread_create(void (*fn)(void)) {
+    proc_t *p;
+    int pid;
+
+    if ((p = alloc_proc()) == 0)
+        return -1;
+    p->kfn = fn;
+    p->ctx.ra = (uint64)kthread_entry;
+    pid = p->pid;
+    make_runnable(p, 0);
+    release(&p->lock);
+    return pid;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int kwait(uint64 addr) {
@@ -377,13 +613,24 @@ int kwait(uint64 addr) {
 // Re-acquires lk when awakened.
 void sleep(void *chan, spinlock_t *lk) {
     proc_t *p = myproc();
+    sleepq_t *q = sleepq_of(chan);
 
     acquire(&p->lock);
-    release(lk);
-
+    charge(p);
     p->chan = chan;
     p->state = SLEEPING;
 
+    // queued before lk is released, so a wakeup under lk sees p
+    p->sqnext = 0;
+    acquire(&q->lock);
+    if (q->tail)
+        q->tail->sqnext = p;
+    else
+        q->head = p;
+    q->tail = p;
+    release(&q->lock);
+    release(lk);
+
     proc_sched();
 
     p->chan = 0;
@@ -391,19 +638,55 @@ void sleep(void *chan, spinlock_t *lk) {
     acquire(lk);
 }
 
+// take up to max sleepers on chan off their queue, oldest first,
+// and make them RUNNABLE.
+static void wake(void *chan, int max) {
+    sleepq_t *q = sleepq_of(chan);
+    proc_t *p, **pp, *prev = 0, *woken = 0, **tail = &woken;
+    int n = 0;
+
+    acquire(&q->lock);
+    for (pp = &q->head; (p = *pp) != 0 && n < max; ) {
+        if (p->chan == chan) {
+            *pp = p->sqnext;
+            if (q->tail == p)
+                q->tail = prev;
+            p->sqnext = 0;
+            *tail = p;
+            tail = &p->sqnext;
+            n++;
+        } else {
+            prev = p;
+            pp = &p->sqnext;
+        }
+    }
+    release(&q->lock);
+
+    // off the queue, so nobody else wakes them. a sleeper still
+    // on its way into proc_sched holds p->lock until it is off its hart.
+    while ((p = woken) != 0) {
+        woken = p->sqnext;
+        acquire(&p->lock);
+        if (p->state != SLEEPING)
+            panic("wakeup: not SLEEPING");
+        make_runnable(p, SLEEP_CREDIT);
+        release(&p->lock);
+    }
+}
+
 // Wake up all processes sleeping on channel chan.
 // Caller should hold the condition lock.
 void wakeup(void *chan) {
-    proc_t *p;
-    for (p = proc; p < &proc[NPROC]; p++) {
-        if (p != myproc()) {
-            acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
-        }
-    }
+    wake(chan, NPROC);
+}
+
+// Wake up the process that has slept longest on chan.
+// Only for channels where any sleeper can use what the
+// waker made available, and one that cannot use all of it
+// passes the rest on with another wakeup_one.
+// Caller should hold the condition lock.
+void wakeup_one(void *chan) {
+    wake(chan, 1);
 }
 
 // Per-CPU process scheduler.
@@ -416,28 +699,52 @@ void wakeup(void *chan) {
 void proc_scheduler(void) {
     proc_t *p;
     cpu_t *c = mycpu();
+    int id = cpuid();
+    runq_t *rq = &runq[id], *victim;
+    uint64 wait;
 
     c->proc = 0;
     for (;;) {
         intr_on();
         intr_off();
 
-        int found = 0;
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if(p->state == RUNNABLE) {
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->ctx, &p->ctx);
-
-                c->proc = 0;
-                found = 1;
-            }
-            release(&p->lock);
+        victim = 0;
+        if ((p = runq_pop(rq)) == 0 && (p = runq_steal(id, &victim)) != 0)
+            rq->steals++;
+        if (p == 0) {
+            // nothing to run, prepare zeroed pages instead of sleeping
+            if (pmem_zero_idle() == 0)
+                asm volatile("wfi");
+            continue;
         }
-        if (found == 0) {
-            asm volatile("wfi");
+
+        // off every queue, so no other hart can pick it meanwhile
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler: queued proc not RUNNABLE");
+        if (victim) {
+            // keep its lead or lag over the victim's queue
+            p->vruntime = p->vruntime - victim->minv + rq->minv;
+            if ((long)p->vruntime < 0)
+                p->vruntime = 0;
         }
+        wait = r_time() - p->rqtime;
+        rq->runs++;
+        rq->wait += wait;
+        if (wait > rq->maxwait)
+            rq->maxwait = wait;
+
+        if (p->vruntime > rq->minv)
+            rq->minv = p->vruntime;
+
+        p->cpu = id;
+        p->lastrun = r_time();
+        p->state = RUNNING;
+        c->proc = p;
+        swtch(&c->ctx, &p->ctx);
+
+        c->proc = 0;
+        release(&p->lock);
     }
 }
 
@@ -474,7 +781,8 @@ void init_zero(void) {
 
     // about file system
     p->cwd = namei("/");
-    
+
+    make_runnable(p, 0);
     release(&p->lock);
 }
 
@@ -485,7 +793,8 @@ yield(void)
 {
   proc_t *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  charge(p);
+  make_runnable(p, 0);
   proc_sched();
   release(&p->lock);
 }
@@ -520,13 +829,12 @@ void forkret(void) {
         // set inst and stack
         // inst
         extern unsigned char kernel_proc_initcode[];
-        uint64 code_page = (uint64)pmem_alloc(1);
-        memset((void*)code_page, 0, PGSIZE);
+        uint64 code_page = (uint64)pmem_alloc(1 | PMEM_ZERO);
         memmove((void*)code_page, kernel_proc_initcode, sizeof(kernel_proc_initcode));
         vm_mappages(p->pgtbl, 0, PGSIZE, code_page, PTE_R | PTE_X | PTE_U);
         p->trapframe->epc = 0;
         // stack
-        vm_mappages(p->pgtbl, PGSIZE, PGSIZE, (uint64)pmem_alloc(1), PTE_W | PTE_R | PTE_U);
+        vm_mappages(p->pgtbl, PGSIZE, PGSIZE, (uint64)pmem_alloc(1 | PMEM_ZERO), PTE_W | PTE_R | PTE_U);
         p->trapframe->sp = 2*PGSIZE;
 
         // p->trapframe->a0 = kexec("/init", (char *[]){ "/init", 0});
@@ -33,6 +33,10 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_pipesize(void);
+extern uint64 sys_nice(void);
 
 // An array mapping syscall num to the function
 static uint64 (*syscalls[])(void) = {
@@ -60,6 +64,10 @@ static uint64 (*syscalls[])(void) = {
     [SYS_close]   sys_close,
     [SYS_mmap]  sys_mmap,
     [SYS_munmap] sys_munmap,
+    [SYS_sync]   sys_sync,
+    [SYS_fsync]  sys_fsync,
+    [SYS_pipesize] sys_pipesize,
+    [SYS_nice]   sys_nice,
 };
 
 // handle syscall, called in trap_user.c
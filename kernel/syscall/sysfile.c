@@ -109,6 +109,24 @@ uint64 sys_fstat(void) {
     return filestat(f, st);
 }
 
+// write every dirty block to disk.
+uint64 sys_sync(void) {
+    buf_sync();
+    return 0;
+}
+
+// write the dirty blocks of an open file to disk.
+uint64 sys_fsync(void) {
+    struct file *f;
+
+    if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+        return -1;
+    ilock(f->ip);
+    ifsync(f->ip);
+    iunlock(f->ip);
+    return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64 sys_link(void) {
     char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
@@ -117,16 +135,16 @@ uint64 sys_link(void) {
     if(arg_str(0, old, MAXPATH) < 0 || arg_str(1, new, MAXPATH) < 0)
         return -1;
 
-    //begin_op();
+    begin_op();
     if((ip = namei(old)) == 0){
-        //end_op();
+        end_op();
         return -1;
     }
 
     ilock(ip);
     if(ip->type == T_DIR){
         iunlockput(ip);
-        //end_op();
+        end_op();
         return -1;
     }
 
@@ -144,7 +162,7 @@ uint64 sys_link(void) {
     iunlockput(dp);
     iput(ip);
 
-    //end_op();
+    end_op();
 
     return 0;
 
@@ -153,7 +171,7 @@ bad:
     ip->nlink--;
     iupdate(ip);
     iunlockput(ip);
-    //end_op();
+    end_op();
     return -1;
 }
 
@@ -180,9 +198,9 @@ uint64 sys_unlink(void) {
     if(arg_str(0, path, MAXPATH) < 0)
         return -1;
 
-    //begin_op();
+    begin_op();
     if((dp = nameiparent(path, name)) == 0){
-        //end_op();
+        end_op();
         return -1;
     }
 
@@ -206,6 +224,7 @@ uint64 sys_unlink(void) {
     memset(&de, 0, sizeof(de));
     if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
         panic("unlink: writei");
+    dcache_enter(dp->dev, dp->inum, name, 0, 0);
     if(ip->type == T_DIR){
         dp->nlink--;
         iupdate(dp);
@@ -216,13 +235,13 @@ uint64 sys_unlink(void) {
     iupdate(ip);
     iunlockput(ip);
 
-    //end_op();
+    end_op();
 
     return 0;
 
 bad:
     iunlockput(dp);
-    //end_op();
+    end_op();
     return -1;
 }
 
@@ -244,7 +263,7 @@ static struct inode* create(char *path, short type, short major, short minor) {
         return 0;
     }
 
-    if((ip = ialloc(dp->dev, type)) == 0){
+    if((ip = ialloc(dp->dev, type, dp->inum)) == 0){
         iunlockput(dp);
         return 0;
     }
@@ -295,25 +314,25 @@ uint64 sys_open(void) {
     //printf("DEBUG: sys_open failed 1\n");
     return -1;
   }
-  //begin_op();
+  begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
-      //end_op();
+      end_op();
       //printf("DEBUG: sys_open failed 2\n");
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
-      //end_op();
+      end_op();
       //printf("DEBUG: sys_open failed 3\n");
       return -1;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      //end_op();
+      end_op();
       //printf("DEBUG: sys_open failed 4\n");
       return -1;
     }
@@ -321,7 +340,7 @@ uint64 sys_open(void) {
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    //end_op();
+    end_op();
     //printf("DEBUG: sys_open failed 5\n");
     return -1;
   }
@@ -331,7 +350,7 @@ uint64 sys_open(void) {
       fileclose(f);
     iunlockput(ip);
     //printf("DEBUG: sys_open failed 6\n");
-    //end_op();
+    end_op();
     return -1;
   }
 
@@ -351,7 +370,7 @@ uint64 sys_open(void) {
   }
 
   iunlock(ip);
-  //end_op();
+  end_op();
 
   return fd;
 }
@@ -362,13 +381,13 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  //begin_op();
+  begin_op();
   if(arg_str(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    //end_op();
+    end_op();
     return -1;
   }
   iunlockput(ip);
-  //end_op();
+  end_op();
   return 0;
 }
 
@@ -379,17 +398,17 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  //begin_op();
+  begin_op();
   arg_int(1, &major);
   arg_int(2, &minor);
   if((arg_str(0, path, MAXPATH)) < 0 ||
      (ip = create(path, T_DEVICE, major, minor)) == 0){
-    //end_op();
+    end_op();
     return -1;
   }
   //printf("%s\n", path);
   iunlockput(ip);
-  //end_op();
+  end_op();
   return 0;
 }
 
@@ -400,20 +419,20 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  //begin_op();
+  begin_op();
   if(arg_str(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
-    //end_op();
+    end_op();
     return -1;
   }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
-    //end_op();
+    end_op();
     return -1;
   }
   iunlock(ip);
   iput(p->cwd);
-  //end_op();
+  end_op();
   p->cwd = ip;
   return 0;
 }
@@ -441,7 +460,7 @@ sys_exec(void)
       argv[i] = 0;
       break;
     }
-    argv[i] = pmem_alloc(1);
+    argv[i] = pmem_alloc(1 | PMEM_NOFILL);
     if(argv[i] == 0)
       goto bad;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
@@ -490,3 +509,17 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// set the capacity of pipe fd to at least size bytes,
+// or return it if size is 0.
+uint64
+sys_pipesize(void)
+{
+  struct file *f;
+  int size;
+
+  arg_int(1, &size);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_PIPE)
+    return -1;
+  return pipesize(f->pipe, size);
+}
@@ -39,6 +39,14 @@ uint64 sys_fork(void) {
     return kfork();
 }
 
+// set the nice value (-20..19) of the calling process,
+// returns the old one or -1.
+uint64 sys_nice(void) {
+    int n;
+    arg_int(0, &n);
+    return proc_nice(n);
+}
+
 uint64 sys_wait(void) {
     uint64 p;
     argaddr(0, &p);
@@ -63,7 +71,7 @@ uint64 sys_mmap(void) {
         return 0;
 
     while (size > 0) {
-        pa = (uint64)pmem_alloc(1);
+        pa = (uint64)pmem_alloc(1 | PMEM_ZERO);
         vm_mappages(myproc()->pgtbl, va, PGSIZE, pa, PTE_R | PTE_W | PTE_U);
         va += PGSIZE;
         size -= PGSIZE;
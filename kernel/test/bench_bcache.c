@@ -0,0 +1,81 @@
+#include "types.h"
+#include "param.h"
+#include "defs.h"
+#include "riscv.h"
+#include "lib/spinlock.h"
+#include "lib/sleeplock.h"
+#include "fs/fs.h"
+#include "fs/buf.h"
+#include "fs/stat.h"
+
+// buffer cache hit rate: write a FILESZ (4 MiB) file, then read
+// it back several times.
+// pass 1 follows the write, so it hits on what the cache kept,
+// the later passes should be all hits once the cache has grown
+// past the file size.
+// then the cache is shrunk as far as it goes and the file read
+// once more, which misses like the old 30 buffer cache did on
+// every pass and grows the cache back.
+// the file is never linked into a directory, so the final iput
+// frees it.
+// must run in a process, the disk reads sleep.
+
+#define PASSES 3
+#define FILESZ (4 * 1024 * 1024)
+
+static void read_file(struct inode *ip, char *page, char *name) {
+    uint64 t0 = r_time();
+
+    ilock(ip);
+    for (uint off = 0; off < FILESZ; off += PGSIZE) {
+        if (readi(ip, 0, (uint64)page, off, PGSIZE) != PGSIZE)
+            panic("bench_bcache: read");
+    }
+    iunlock(ip);
+
+    printf("%s: %ld time units per block\n", name, (r_time() - t0) / (FILESZ / BSIZE));
+    buf_stat();
+}
+
+void bench_bcache(void) {
+    // a few blocks per transaction, as filewrite
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    struct inode *ip;
+    char *page;
+    int n = 0, k;
+    uint off;
+
+    if ((page = pmem_alloc(0)) == 0)
+        panic("bench_bcache: page");
+    memset(page, 'b', PGSIZE);
+
+    begin_op();
+    ip = ialloc(ROOTDEV, T_FILE, ROOTINO);
+    end_op();
+    if (ip == 0)
+        panic("bench_bcache: ialloc");
+    for (off = 0; off < FILESZ; off += k) {
+        k = FILESZ - off < max ? FILESZ - off : max;
+        begin_op();
+        ilock(ip);
+        if (writei(ip, 0, (uint64)page, off, k) != k)
+            panic("bench_bcache: write");
+        iunlock(ip);
+        end_op();
+    }
+
+    printf("\nbuffer cache, %d KiB file, %d blocks per pass\n", FILESZ / 1024, FILESZ / BSIZE);
+    buf_stat();
+    for (int i = 1; i <= PASSES; i++)
+        read_file(ip, page, i == 1 ? "first pass" : "warm pass");
+
+    while ((k = buf_reclaim(NBUF_MAX)) > 0)
+        n += k;
+    printf("reclaimed %d pages\n", n);
+    read_file(ip, page, "after shrink");
+
+    begin_op();
+    iput(ip);
+    end_op();
+    pmem_free(page);
+}
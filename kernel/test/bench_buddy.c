@@ -0,0 +1,76 @@
+#include "types.h"
+#include "defs.h"
+#include "riscv.h"
+
+// buddy allocator micro-benchmark.
+// 1. throughput: alloc then free NBLK blocks of each order,
+//    order 0 through the per-hart cache (pmem_alloc) and orders
+//    1 and up through the buddy lists (pmem_alloc_order).
+// 2. fragmentation: pin every other page of a run of kernel pages
+//    and print the free block counts, then free the rest and check
+//    that the blocks merge back to the counts before the test.
+//    the per-hart cache is drained before each count, so they are
+//    the buddy lists' own. other harts must not allocate kernel
+//    pages meanwhile.
+
+#define NBLK 256
+#define NFRAG 2048
+
+static void* blk[NFRAG];
+
+static uint64 bench_order(int order) {
+    uint64 t0 = r_time();
+
+    for (int i = 0; i < NBLK; i++) {
+        if ((blk[i] = pmem_alloc_order(1, order)) == 0)
+            panic("bench_buddy: alloc");
+    }
+    for (int i = 0; i < NBLK; i++)
+        pmem_free_order(blk[i], order);
+
+    return (r_time() - t0) / (2 * NBLK);
+}
+
+void bench_buddy(void) {
+    uint before[PMEM_MAX_ORDER + 1], after[PMEM_MAX_ORDER + 1];
+    uint64 t0, t;
+
+    printf("\nbuddy throughput (time units per alloc or free, %d blocks)\n", NBLK);
+
+    t0 = r_time();
+    for (int i = 0; i < NBLK; i++)
+        blk[i] = pmem_alloc(1);
+    for (int i = 0; i < NBLK; i++)
+        pmem_free(blk[i]);
+    t = (r_time() - t0) / (2 * NBLK);
+    printf("order 0 (cached)\t%ld\n", t);
+
+    for (int order = 1; order <= 4; order++)
+        printf("order %d\t\t%ld\n", order, bench_order(order));
+
+    printf("\nbuddy fragmentation, %d pages with every other one pinned\n", NFRAG);
+    pmem_drain(0);
+    pmem_nblocks(0, before);
+    for (int i = 0; i < NFRAG; i++) {
+        if ((blk[i] = pmem_alloc(0)) == 0)
+            panic("bench_buddy: frag alloc");
+    }
+    for (int i = 0; i < NFRAG; i += 2)
+        pmem_free(blk[i]);
+    pmem_drain(0);
+    pmem_stat();
+
+    printf("after freeing the pinned pages\n");
+    for (int i = 1; i < NFRAG; i += 2)
+        pmem_free(blk[i]);
+    pmem_drain(0);
+    pmem_stat();
+    pmem_nblocks(0, after);
+    for (int k = 0; k <= PMEM_MAX_ORDER; k++) {
+        if (after[k] != before[k]) {
+            printf("order %d: %d free blocks, %d before\n", k, after[k], before[k]);
+            panic("bench_buddy: blocks did not merge back");
+        }
+    }
+    printf("blocks merged back\n");
+}
@@ -0,0 +1,84 @@
+#include "types.h"
+#include "param.h"
+#include "defs.h"
+#include "riscv.h"
+#include "lib/spinlock.h"
+#include "lib/sleeplock.h"
+#include "fs/fs.h"
+#include "fs/buf.h"
+
+// virtio queue depth: read NREQ blocks of the root disk
+// one at a time with virtio_disk_rw, then with up to depth
+// requests in flight through virtio_disk_submit, with one
+// QUEUE_NOTIFY per batch, then MAXDEPTH adjacent blocks per
+// request through virtio_disk_submitv.
+// the buffers bypass the buffer cache, so every read hits the disk.
+// must run in a process, the disk reads sleep.
+
+#define NREQ 256
+#define MAXDEPTH 16
+
+static struct buf bufs[MAXDEPTH];
+
+static uint64 read_depth(int depth) {
+    uint64 t0 = r_time();
+
+    for (int blk = 0; blk < NREQ; blk += depth) {
+        virtio_disk_plug();
+        for (int i = 0; i < depth; i++) {
+            bufs[i].dev = ROOTDEV;
+            bufs[i].blockno = blk + i;
+            virtio_disk_submit(&bufs[i], 0, 0);
+        }
+        virtio_disk_unplug();
+        for (int i = 0; i < depth; i++)
+            virtio_disk_wait(&bufs[i]);
+    }
+    return (r_time() - t0) / NREQ;
+}
+
+static uint64 read_vector(void) {
+    struct buf *bs[MAXDEPTH];
+    uint64 t0 = r_time();
+
+    for (int blk = 0; blk < NREQ; blk += MAXDEPTH) {
+        for (int i = 0; i < MAXDEPTH; i++) {
+            bufs[i].dev = ROOTDEV;
+            bufs[i].blockno = blk + i;
+            bs[i] = &bufs[i];
+        }
+        virtio_disk_submitv(bs, MAXDEPTH, 0, 0);
+        for (int i = 0; i < MAXDEPTH; i++)
+            virtio_disk_wait(&bufs[i]);
+    }
+    return (r_time() - t0) / NREQ;
+}
+
+void bench_disk(void) {
+    char *pages[MAXDEPTH * BSIZE / PGSIZE];
+    uint64 t0;
+
+    for (int i = 0; i < NELEM(pages); i++) {
+        if ((pages[i] = pmem_alloc(0)) == 0)
+            panic("bench_disk: alloc");
+    }
+    for (int i = 0; i < MAXDEPTH; i++)
+        bufs[i].data = (uchar*)pages[i * BSIZE / PGSIZE] + (i * BSIZE) % PGSIZE;
+
+    printf("\nvirtio read latency (time units per block, %d blocks)\n", NREQ);
+
+    t0 = r_time();
+    for (int blk = 0; blk < NREQ; blk++) {
+        bufs[0].dev = ROOTDEV;
+        bufs[0].blockno = blk;
+        virtio_disk_rw(&bufs[0], 0);
+    }
+    printf("virtio_disk_rw\t%ld\n", (r_time() - t0) / NREQ);
+
+    for (int depth = 1; depth <= MAXDEPTH; depth *= 2)
+        printf("depth %d\t\t%ld\n", depth, read_depth(depth));
+    printf("vector of %d\t%ld\n", MAXDEPTH, read_vector());
+
+    for (int i = 0; i < NELEM(pages); i++)
+        pmem_free(pages[i]);
+}
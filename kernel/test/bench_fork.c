@@ -0,0 +1,63 @@
+#include "types.h"
+#include "defs.h"
+#include "riscv.h"
+
+// fork latency: eager vm_u_copy against copy-on-write vm_u_share.
+// a fake parent address space of npages writable user pages is copied
+// into a fresh page table ROUNDS times per size.
+// "cow+write" also breaks every shared page once, which is the
+// worst case for COW (the child writes all of its memory).
+// like kfork, the copy covers the whole user range below the trapframe.
+
+#define ROUNDS 16
+
+static int sizes[] = { 4, 32, 256, 1024 };
+
+static uint64 bench_one(pagetbl_t parent, uint64 sz, int mode) {
+    uint64 total = 0;
+    uint64 range = MAXVA - 2*PGSIZE;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        pagetbl_t child = vm_upage_create();
+        if (child == 0)
+            panic("bench_fork: pagetable");
+
+        uint64 t0 = r_time();
+        if (mode == 0) {
+            if (vm_u_copy(parent, child, range) < 0)
+                panic("bench_fork: copy");
+        } else {
+            if (vm_u_share(parent, child, range) < 0)
+                panic("bench_fork: share");
+            if (mode == 2) {
+                for (uint64 va = 0; va < sz; va += PGSIZE)
+                    vm_cow_fault(child, va);
+            }
+        }
+        total += r_time() - t0;
+
+        vm_upage_free(child, range);
+    }
+    return total / ROUNDS;
+}
+
+void bench_fork(void) {
+    printf("\nfork latency (time units per fork, %d rounds)\n", ROUNDS);
+    printf("pages\teager\tcow\tcow+write\n");
+
+    for (int i = 0; i < NELEM(sizes); i++) {
+        int npages = sizes[i];
+        uint64 sz = (uint64)npages * PGSIZE;
+        pagetbl_t parent = vm_upage_create();
+
+        if (parent == 0 || vm_u_alloc(parent, 0, sz, PTE_W) == 0)
+            panic("bench_fork: parent");
+
+        uint64 eager = bench_one(parent, sz, 0);
+        uint64 cow = bench_one(parent, sz, 1);
+        uint64 cow_write = bench_one(parent, sz, 2);
+        printf("%d\t%ld\t%ld\t%ld\n", npages, eager, cow, cow_write);
+
+        vm_upage_free(parent, sz);
+    }
+}
@@ -0,0 +1,99 @@
+#include "types.h"
+#include "param.h"
+#include "defs.h"
+#include "riscv.h"
+
+// str.c micro-benchmark: memset, memmove, memcmp and strlen of each
+// size, with the destination word aligned and one byte off, done by
+// byte loops (the old str.c), by the word loops and, if the harts
+// have the V extension, by str_rvv.S.
+// prints time units per ROUNDS calls.
+
+#define ROUNDS 64
+#define MAXSZ  4096
+
+static int sizes[] = { 16, 64, 256, 4096 };
+
+static char src[MAXSZ + 16], dst[MAXSZ + 16];
+
+static void byte_memset(char *d, int c, uint n) {
+    while (n-- > 0)
+        *d++ = c;
+}
+
+static void byte_memmove(char *d, const char *s, uint n) {
+    while (n-- > 0)
+        *d++ = *s++;
+}
+
+static int byte_memcmp(const uchar *s1, const uchar *s2, uint n) {
+    for (; n > 0; n--, s1++, s2++) {
+        if (*s1 != *s2)
+            return *s1 - *s2;
+    }
+    return 0;
+}
+
+static int byte_strlen(const char *s) {
+    int n;
+
+    for (n = 0; s[n]; n++)
+        ;
+    return n;
+}
+
+// mode 0 is the byte loops, 1 and 2 are str.c without and with rvv
+static uint64 bench_one(int op, int mode, int size, int off) {
+    char *d = dst + off;
+    uint64 t0, t;
+    int r, rvv = str_rvv;
+
+    memmove(d, src, size);
+    d[size] = 0;
+    str_rvv = mode == 2;
+    t0 = r_time();
+    for (r = 0; r < ROUNDS; r++) {
+        switch (op) {
+        case 0:
+            if (mode) memset(d, r, size); else byte_memset(d, r, size);
+            break;
+        case 1:
+            if (mode) memmove(d, src, size); else byte_memmove(d, src, size);
+            break;
+        case 2:
+            if ((mode ? memcmp(d, src, size) : byte_memcmp((uchar*)d, (uchar*)src, size)) != 0)
+                panic("bench_str: memcmp");
+            break;
+        case 3:
+            if ((mode ? strlen(d) : byte_strlen(d)) != size)
+                panic("bench_str: strlen");
+            break;
+        }
+    }
+    t = r_time() - t0;
+    str_rvv = rvv;
+    return t;
+}
+
+void bench_str(void) {
+    static char *ops[] = { "memset", "memmove", "memcmp", "strlen" };
+    int nmode = str_rvv ? 3 : 2;
+
+    for (int i = 0; i < MAXSZ; i++)
+        src[i] = 'a' + i % 26;
+    src[MAXSZ] = 0;
+
+    printf("\nstr.c (time units per %d calls)%s\n", ROUNDS,
+           str_rvv ? "" : ", no vector extension");
+    printf("op\tbytes\toff\tbyte\tword\trvv\n");
+    for (int op = 0; op < NELEM(ops); op++) {
+        for (int i = 0; i < NELEM(sizes); i++) {
+            for (int off = 0; off <= 1; off++) {
+                printf("%s\t%d\t%d", ops[op], sizes[i], off);
+                for (int mode = 0; mode < nmode; mode++)
+                    printf("\t%ld", bench_one(op, mode, sizes[i], off));
+                printf("\n");
+            }
+        }
+    }
+}
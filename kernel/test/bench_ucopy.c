@@ -0,0 +1,68 @@
+#include "types.h"
+#include "param.h"
+#include "defs.h"
+#include "riscv.h"
+
+// user copy throughput: copyout and copyin of each size between a
+// kernel buffer and a fake user address space, with the user address
+// word aligned and one byte off, and copyinstr of a path-long string.
+// prints bytes per cycle, with two decimals.
+
+#define NPAGES 8
+#define ROUNDS 256
+
+static int sizes[] = { 16, 64, 512, 4096, 16384 };
+
+static char kbuf[NPAGES * PGSIZE];
+
+// bytes per cycle times 100
+static uint64 rate(uint64 bytes, uint64 cycles) {
+    return cycles ? bytes * 100 / cycles : 0;
+}
+
+static void print_rate(uint64 r, char *end) {
+    printf("%ld.%d%d%s", r / 100, (int)(r / 10 % 10), (int)(r % 10), end);
+}
+
+static void bench_one(pagetbl_t pt, int size, int off, int in, char *end) {
+    uint64 c0 = r_cycle();
+
+    for (int r = 0; r < ROUNDS; r++) {
+        if (in ? copyin(pt, kbuf, off, size) : copyout(pt, off, kbuf, size))
+            panic("bench_ucopy: copy");
+    }
+    print_rate(rate((uint64)size * ROUNDS, r_cycle() - c0), end);
+}
+
+void bench_ucopy(void) {
+    uint64 sz = NPAGES * PGSIZE;
+    pagetbl_t pt = vm_upage_create();
+    uint64 c0;
+
+    if (pt == 0 || vm_u_alloc(pt, 0, sz, PTE_W) == 0)
+        panic("bench_ucopy: pagetable");
+
+    printf("\nuser copy throughput (bytes per cycle, %d rounds)\n", ROUNDS);
+    printf("bytes\tout\tout+1\tin\tin+1\n");
+    for (int i = 0; i < NELEM(sizes); i++) {
+        int size = sizes[i];
+        printf("%d\t", size);
+        bench_one(pt, size, 0, 0, "\t");
+        bench_one(pt, size, 1, 0, "\t");
+        bench_one(pt, size, 0, 1, "\t");
+        bench_one(pt, size, 1, 1, "\n");
+    }
+
+    memset(kbuf, 'a', MAXPATH - 1);
+    kbuf[MAXPATH - 1] = 0;
+    copyout(pt, 0, kbuf, MAXPATH);
+    c0 = r_cycle();
+    for (int r = 0; r < ROUNDS; r++) {
+        if (copyinstr(pt, kbuf, 0, MAXPATH) < 0)
+            panic("bench_ucopy: copyinstr");
+    }
+    printf("copyinstr %d\t", MAXPATH);
+    print_rate(rate((uint64)MAXPATH * ROUNDS, r_cycle() - c0), "\n");
+
+    vm_upage_free(pt, sz);
+}
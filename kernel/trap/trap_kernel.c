@@ -1,4 +1,5 @@
 #include "types.h"
+#include "param.h"
 #include "defs.h"
 #include "riscv.h"
 #include "memlayout.h"
@@ -69,7 +70,7 @@ void trap_kernel_handler() {
     } else if(scause == 0x8000000000000005L) {
         // STI
         timer_interrupt_handler();
-        if (myproc() != 0) {
+        if (sched_preempt()) {
             yield();
             // the yield() may have caused some traps to occur,
             // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -91,7 +92,7 @@ void timer_interrupt_handler() {
         timer_update();
     }
 
-    w_stimecmp(r_time() + 1000000);
+    w_stimecmp(r_time() + TICK);
 }
 
 void external_interrupt_handler() {
@@ -48,7 +48,14 @@ uint64 trap_user_handler() {
     } else if(scause == 0x8000000000000005L) {
         // STI
         timer_interrupt_handler();
-        yield();
+        if (sched_preempt())
+            yield();
+    } else if (scause == 15) {
+        // store page fault, may hit a copy-on-write page
+        if (vm_cow_fault(p->pgtbl, stval) < 0) {
+            printf("store page fault: pid=%d sepc=0x%lx stval=0x%lx\n", p->pid, sepc, stval);
+            kexit(-1);
+        }
     } else {
         printf("unexpected scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, sepc, stval);
     }
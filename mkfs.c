@@ -15,8 +15,6 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
@@ -31,6 +29,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int extents;  // -e: map file blocks with extents (FS_EXTENT)
 
 
 void balloc(int);
@@ -40,6 +39,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirhashify(uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -77,8 +77,14 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 1 && strcmp(argv[1], "-e") == 0){
+    extents = 1;
+    argc--;
+    argv++;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] fs.img files...\n");
     exit(1);
   }
 
@@ -101,9 +107,11 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.flags = xint(extents ? FS_EXTENT : 0);
+  sb.groupsize = xint(BPB);  // one bitmap block per group
 
-  printf("nmeta %d (boot, super, log blocks %u, inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u, inode blocks %u, bitmap blocks %u) blocks %d total %d%s\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, extents ? " extents" : "");
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -165,9 +173,13 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(off > BSIZE){
+    dirhashify(rootino);
+  } else {
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -251,6 +263,68 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// block bn of the tree of depth levels under *root,
+// allocating the missing blocks.
+uint
+tmap(uint *root, uint bn, int depth)
+{
+  uint a[NINDIRECT], x, idx;
+
+  if(xint(*root) == 0)
+    *root = xint(freeblock++);
+  x = xint(*root);
+  while(depth-- > 0){
+    idx = (depth ? bn / NINDIRECT : bn) % NINDIRECT;
+    rsect(x, (char*)a);
+    if(a[idx] == 0){
+      a[idx] = xint(freeblock++);
+      wsect(x, (char*)a);
+    }
+    x = xint(a[idx]);
+  }
+  return x;
+}
+
+// disk block of file block fbn, like bmap in the kernel.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  struct extent *e = (struct extent*)din->addrs;
+  uint first = 0, len;
+  int i;
+
+  if(extents){
+    for(i = 0; i < NEXTENT && e[i].len; i++){
+      len = xint(e[i].len);
+      if(fbn < first + len)
+        return xint(e[i].start) + fbn - first;
+      first += len;
+    }
+    if(fbn == first && din->addrs[INDIRECT] == 0){
+      if(i > 0 && xint(e[i-1].start) + xint(e[i-1].len) == freeblock){
+        e[i-1].len = xint(xint(e[i-1].len) + 1);
+        return freeblock++;
+      }
+      if(i < NEXTENT){
+        e[i].start = xint(freeblock);
+        e[i].len = xint(1);
+        return freeblock++;
+      }
+    }
+    fbn -= first;
+  } else {
+    if(fbn < NDIRECT)
+      return tmap(&din->addrs[fbn], 0, 0);
+    fbn -= NDIRECT;
+  }
+
+  if(fbn < NINDIRECT)
+    return tmap(&din->addrs[INDIRECT], fbn, 1);
+  fbn -= NINDIRECT;
+  assert(fbn < NDINDIRECT);
+  return tmap(&din->addrs[DINDIRECT], fbn, 2);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -258,7 +332,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,22 +340,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,6 +353,58 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// rewrite directory inum, larger than one block, in the hashed
+// format of fs.h, with the fewest buckets that hold its names.
+void
+dirhashify(uint inum)
+{
+  static struct dirent old[DPB << DH_MAXDEPTH], b[1 + (1 << DH_MAXDEPTH)][DPB];
+  struct dinode din;
+  uint fbn, nold, nblk, depth, i, j, cnt[1 << DH_MAXDEPTH];
+
+  rinode(inum, &din);
+  nblk = (xint(din.size) + BSIZE - 1) / BSIZE;
+  assert(nblk <= (1 << DH_MAXDEPTH));
+  for(fbn = 0; fbn < nblk; fbn++)
+    rsect(bmap(&din, fbn), (char*)&old[fbn * DPB]);
+  nold = xint(din.size) / sizeof(struct dirent);
+
+  for(depth = 1; ; depth++){
+    assert(depth <= DH_MAXDEPTH);
+    memset(cnt, 0, sizeof(cnt));
+    for(i = DH_HEAD; i < nold; i++)
+      if(old[i].inum)
+        cnt[dirhash(old[i].name) & ((1 << depth) - 1)]++;
+    for(j = 0; j < (1 << depth) && cnt[j] < DPB; j++)
+      ;
+    if(j == (1 << depth))
+      break;
+  }
+
+  memset(b, 0, sizeof(b));
+  b[0][0] = old[0];  // "."
+  b[0][1] = old[1];  // ".."
+  b[0][DH_HEAD].name[0] = depth;
+  for(j = 0; j < (1 << depth); j++){
+    uint bn = xint(j + 1);
+    memmove(b[0][DH_TABLE + j / DH_PERSLOT].name + (j % DH_PERSLOT) * sizeof(uint), &bn, sizeof(uint));
+    b[j + 1][0].name[0] = depth;
+    cnt[j] = 1;
+  }
+  for(i = DH_HEAD; i < nold; i++){
+    if(old[i].inum){
+      j = dirhash(old[i].name) & ((1 << depth) - 1);
+      b[j + 1][cnt[j]++] = old[i];
+    }
+  }
+
+  for(fbn = 0; fbn < 1 + (1 << depth); fbn++)
+    wsect(bmap(&din, fbn), (char*)b[fbn]);
+  din.size = xint((1 + (1 << depth)) * BSIZE);
+  din.major = xshort(DIR_HASHED);
+  winode(inum, &din);
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,85 @@
+#include "userlib.h"
+#include "fs/fcntl.h"
+
+// 大目录测试
+// 在一个目录里创建N个文件, 再逐个打开(查找), 最后全部删除
+// 目录超过一个块后变成哈希目录, 每个操作的时间应该基本不随N增长
+// 时间单位为1000个time单位, 每个操作的平均值
+
+static int sizes[] = {50, 200, 800};
+
+static void name(char* buf, int i)
+{
+    char tmp[8];
+    int n = 0;
+
+    buf[0] = 'f';
+    do {
+        tmp[n++] = '0' + i % 10;
+        i /= 10;
+    } while (i > 0);
+    for (int k = 0; k < n; k++)
+        buf[1 + k] = tmp[n - 1 - k];
+    buf[1 + n] = 0;
+}
+
+static int run(int n)
+{
+    char buf[16];
+    uint64 t0, tc, tl, td;
+
+    t0 = time();
+    for (int i = 0; i < n; i++) {
+        name(buf, i);
+        int fd = sys_open(buf, O_CREATE | O_RDWR);
+        if (fd < 0) {
+            printf("dirbench: create %s failed\n", buf);
+            return -1;
+        }
+        sys_close(fd);
+    }
+    tc = time() - t0;
+
+    t0 = time();
+    for (int i = 0; i < n; i++) {
+        name(buf, i);
+        int fd = sys_open(buf, O_RDWR);
+        if (fd < 0) {
+            printf("dirbench: open %s failed\n", buf);
+            return -1;
+        }
+        sys_close(fd);
+    }
+    tl = time() - t0;
+
+    t0 = time();
+    for (int i = 0; i < n; i++) {
+        name(buf, i);
+        if (sys_unlink(buf) < 0) {
+            printf("dirbench: unlink %s failed\n", buf);
+            return -1;
+        }
+    }
+    td = time() - t0;
+
+    printf("%d\t%d\t%d\t%d\n", n, (int)(tc / n / 1000), (int)(tl / n / 1000), (int)(td / n / 1000));
+    return 0;
+}
+
+int main()
+{
+    if (sys_mkdir("dirbench.d") < 0 || sys_chdir("dirbench.d") < 0) {
+        printf("dirbench: mkdir failed\n");
+        return -1;
+    }
+
+    printf("dirbench: files\tcreate\topen\tunlink\n");
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (run(sizes[i]) < 0)
+            break;
+    }
+
+    sys_chdir("..");
+    sys_unlink("dirbench.d");
+    return 0;
+}
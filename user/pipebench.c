@@ -0,0 +1,63 @@
+#include "userlib.h"
+
+// 管道吞吐量测试
+// 子进程向管道写入TOTAL字节, 每次CHUNK字节, 父进程读出
+// 分别用默认容量和sys_pipesize扩大后的容量各测一次
+// 时间单位为1000个time单位
+
+#define TOTAL (1024 * 1024)
+#define CHUNK 4096
+
+static char buf[CHUNK];
+static int sizes[] = {0, 16 * 1024, 64 * 1024};
+
+static int run(int size)
+{
+    int fd[2];
+
+    if (sys_pipe(fd) < 0) {
+        printf("pipebench: pipe failed\n");
+        return -1;
+    }
+    if (size > 0 && sys_pipesize(fd[1], size) < 0) {
+        printf("pipebench: pipesize %d failed\n", size);
+        return -1;
+    }
+    size = sys_pipesize(fd[1], 0);
+
+    uint64 t0 = time();
+    int pid = sys_fork();
+    if (pid == 0) {
+        sys_close(fd[0]);
+        for (int n = 0; n < TOTAL; n += CHUNK)
+            sys_write(fd[1], CHUNK, buf);
+        sys_close(fd[1]);
+        sys_exit(0);
+    }
+    sys_close(fd[1]);
+
+    int total = 0, n;
+    while ((n = sys_read(fd[0], CHUNK, buf)) > 0)
+        total += n;
+    sys_close(fd[0]);
+    sys_wait(0);
+    uint64 t = time() - t0;
+
+    if (total != TOTAL)
+        printf("pipebench: read %d of %d bytes\n", total, TOTAL);
+    printf("%d\t\t%d\n", size, (int)(t / 1000));
+    return 0;
+}
+
+int main()
+{
+    memset(buf, 'p', CHUNK);
+
+    printf("pipebench: %d bytes in writes of %d\n", TOTAL, CHUNK);
+    printf("capacity\ttime\n");
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (run(sizes[i]) < 0)
+            break;
+    }
+    return 0;
+}
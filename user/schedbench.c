@@ -0,0 +1,84 @@
+#include "userlib.h"
+
+// 调度延迟测试
+// NBATCH个批处理进程空转DURATION时间, 同时父子进程通过两个管道
+// 来回传递一个字节(交互式负载), 记录每次往返的时间
+// 分别在批处理进程nice为0和19时各测一次, 输出延迟的中位数/p99/最大值
+// 时间单位为1000个time单位
+
+#define NBATCH   6
+#define DURATION 30000000UL
+#define NPING    512
+
+static uint64 lat[NPING];
+static int nices[] = {0, 19};
+
+static void spin(int nice, uint64 end)
+{
+    sys_nice(nice);
+    while (time() < end)
+        ;
+    sys_exit(0);
+}
+
+static void sort(uint64 *a, int n)
+{
+    for (int i = 1; i < n; i++) {
+        uint64 x = a[i];
+        int j;
+        for (j = i; j > 0 && a[j - 1] > x; j--)
+            a[j] = a[j - 1];
+        a[j] = x;
+    }
+}
+
+static void run(int nice)
+{
+    int ping[2], pong[2];
+    uint64 end = time() + DURATION;
+    char c = 'x';
+    int n, i;
+
+    for (i = 0; i < NBATCH; i++) {
+        if (sys_fork() == 0)
+            spin(nice, end);
+    }
+
+    sys_pipe(ping);
+    sys_pipe(pong);
+    if (sys_fork() == 0) {
+        // 应答进程: 收到一个字节就发回去
+        sys_close(ping[1]);
+        sys_close(pong[0]);
+        while (sys_read(ping[0], 1, &c) == 1)
+            sys_write(pong[1], 1, &c);
+        sys_exit(0);
+    }
+    sys_close(ping[0]);
+    sys_close(pong[1]);
+
+    for (n = 0; n < NPING && time() < end; n++) {
+        uint64 t0 = time();
+        sys_write(ping[1], 1, &c);
+        sys_read(pong[0], 1, &c);
+        lat[n] = time() - t0;
+    }
+    sys_close(ping[1]);
+    sys_close(pong[0]);
+    for (i = 0; i < NBATCH + 1; i++)
+        sys_wait(0);
+
+    sort(lat, n);
+    printf("%d\t\t%d\t%d\t%d\t%d\n", nice, n,
+           (int)(lat[n / 2] / 1000), (int)(lat[n * 99 / 100] / 1000),
+           (int)(lat[n - 1] / 1000));
+}
+
+int main()
+{
+    printf("schedbench: %d batch procs, round trip latency\n", NBATCH);
+    printf("batch nice\trounds\tp50\tp99\tmax\n");
+    for (int i = 0; i < sizeof(nices) / sizeof(nices[0]); i++)
+        run(nices[i]);
+    return 0;
+}
@@ -61,6 +61,14 @@ int strlen(const char *str)
   return i;
 }
 
+// 读time寄存器 单位与内核的r_time相同
+uint64 time()
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r" (x));
+    return x;
+}
+
 // 下面的函数用于支持printf
 
 static char digits[] = "0123456789abcdef";
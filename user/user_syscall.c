@@ -123,3 +123,35 @@ int sys_unlink(char* path)
 {
     return syscall(SYS_unlink, path);
 }
+
+// 把所有脏块写回磁盘 返回0
+int sys_sync()
+{
+    return syscall(SYS_sync);
+}
+
+// 把fd的脏块写回磁盘 成功返回0 失败返回-1
+int sys_fsync(int fd)
+{
+    return syscall(SYS_fsync, fd);
+}
+
+// 成功返回0 fd[0]读 fd[1]写 失败返回-1
+int sys_pipe(int* fd)
+{
+    return syscall(SYS_pipe, fd);
+}
+
+// 把管道容量设为至少size字节(size为0时只查询)
+// 成功返回新的容量 失败返回-1
+int sys_pipesize(int fd, int size)
+{
+    return syscall(SYS_pipesize, fd, size);
+}
+
+// 设置当前进程的nice值(-20到19, 越小分到的CPU越多)
+// 成功返回原来的nice值 失败返回-1
+int sys_nice(int nice)
+{
+    return syscall(SYS_nice, nice);
+}
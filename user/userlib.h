@@ -60,6 +60,11 @@ int sys_mkdir(char* path);
 int sys_chdir(char* path);
 int sys_link(char* old_path, char* new_path);
 int sys_unlink(char* path);
+int sys_sync();
+int sys_fsync(int fd);
+int sys_pipe(int* fd);
+int sys_pipesize(int fd, int size);
+int sys_nice(int nice);
 
 // 来自user_lib.c
 
@@ -71,6 +76,7 @@ void   memmove(void* dst, const void* src, uint32 n);
 int    strncmp(const char *p, const char *q, uint32 n);
 int    strlen(const char *str);
 void   printf(const char* fmt, ...);
+uint64 time();
 //void   print_dirents(dirent_t* dir, uint32 count);
 //void   print_filestate(fstat_t* file);
 
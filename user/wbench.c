@@ -0,0 +1,50 @@
+#include "userlib.h"
+#include "fs/fcntl.h"
+
+// 写吞吐量测试
+// 向文件追加NWRITES条RECSZ字节的小记录
+// "write-back": 写入只进入buffer cache, 最后fsync一次
+// "fsync each": 每条记录都fsync, 相当于原来的write-through
+// 时间单位为1000个time单位
+
+#define NWRITES 256
+#define RECSZ   128
+
+static char rec[RECSZ];
+
+static int run(char* path, int each)
+{
+    int fd = sys_open(path, O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("wbench: open %s failed\n", path);
+        return -1;
+    }
+
+    uint64 t0 = time();
+    for (int i = 0; i < NWRITES; i++) {
+        sys_write(fd, RECSZ, rec);
+        if (each)
+            sys_fsync(fd);
+    }
+    sys_fsync(fd);
+    uint64 t = time() - t0;
+
+    sys_close(fd);
+    sys_unlink(path);
+    return (int)(t / 1000);
+}
+
+int main()
+{
+    memset(rec, 'w', RECSZ);
+
+    int wb = run("wbench.a", 0);
+    int wt = run("wbench.b", 1);
+
+    printf("wbench: %d writes of %d bytes\n", NWRITES, RECSZ);
+    printf("write-back  %d\n", wb);
+    printf("fsync each  %d\n", wt);
+    if (wb > 0)
+        printf("speedup     %dx\n", wt / wb);
+    return 0;
+}